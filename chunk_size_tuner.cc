@@ -0,0 +1,442 @@
+// Replays an append/read workload against stable_vector instantiated with several chunk sizes and
+// allocation policies, and reports throughput, memory overhead and append tail latency for each.
+//
+// usage: chunk_size_tuner [--elements N] [--element-size 8|16|32|64|128|256]
+//                         [--access none|sequential|random|recent] [--reads-per-append R]
+//                         [--scans S] [--trace FILE]
+//
+// Throughput is measured on batches of operations, without timing each one. Append latencies are
+// sampled in a separate pass over a fresh container, timing every append.
+//
+// A trace file replaces the synthetic workload; it holds one operation per line:
+//   append <count>
+//   read <index>     (taken modulo the current size)
+//   scan
+
+#include "stable_vector.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+enum class access_pattern { none, sequential, random, recent };
+
+enum class allocation_policy { on_demand, reserved };
+
+struct operation
+{
+	enum class type { append, read, scan };
+
+	type op;
+	std::size_t value;
+};
+
+struct workload
+{
+	std::size_t elements = 10000000;
+	std::size_t element_size = 8;
+	access_pattern access = access_pattern::random;
+	std::size_t reads_per_append = 1;
+	std::size_t scans = 4;
+	std::vector<operation> trace;
+};
+
+struct result
+{
+	std::size_t final_size = 0;
+	double append_mops = 0;
+	double read_mops = 0;
+	double scan_gbs = 0;
+	double overhead = 0;
+	double p50 = 0;
+	double p99 = 0;
+	double p999 = 0;
+	double max = 0;
+};
+
+template <std::size_t Bytes>
+struct payload
+{
+	payload() = default;
+	explicit payload(std::size_t i) { data.fill(static_cast<char>(i)); }
+
+	std::array<char, Bytes> data;
+};
+
+double seconds(clock_type::duration d)
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+// Keeps a value, and the computations leading to it, from being optimized away.
+template <class T>
+void do_not_optimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// appends and reads of the synthetic workload are timed by batches of this many elements
+constexpr std::size_t batch_size = 64;
+
+template <class T, std::size_t ChunkSize>
+class runner
+{
+public:
+	runner(const workload& w, allocation_policy policy) :
+		m_workload(w),
+		m_budget(std::numeric_limits<std::size_t>::max()),
+		m_reserved(policy == allocation_policy::reserved)
+	{
+		m_vector.set_memory_budget(&m_budget);
+		if (m_reserved)
+		{
+			m_vector.reserve(final_size());
+		}
+	}
+
+	result run()
+	{
+		if (m_workload.trace.empty())
+		{
+			run_synthetic();
+		}
+		else
+		{
+			run_trace();
+		}
+
+		result r;
+		r.final_size = m_vector.size();
+		r.append_mops = static_cast<double>(m_appends) / seconds(m_append_time) / 1e6;
+		r.read_mops = m_reads ? static_cast<double>(m_reads) / seconds(m_read_time) / 1e6 : 0;
+		r.scan_gbs = m_scanned ? static_cast<double>(m_scanned * sizeof(T)) / seconds(m_scan_time) / 1e9 : 0;
+
+		// chunk storage plus the chunk directory, relative to the payload
+		const double used = static_cast<double>(m_vector.size() * sizeof(T));
+		const double allocated = static_cast<double>(m_budget.used() + m_vector.chunk_count() * sizeof(void*) * 2);
+		r.overhead = used ? (allocated - used) / used * 100 : 0;
+
+		m_vector.clear();
+		sample_latencies();
+		std::sort(m_latencies.begin(), m_latencies.end());
+		r.p50 = percentile(0.5);
+		r.p99 = percentile(0.99);
+		r.p999 = percentile(0.999);
+		r.max = m_latencies.empty() ? 0 : static_cast<double>(m_latencies.back());
+		return r;
+	}
+
+	std::size_t checksum() const { return m_checksum; }
+
+private:
+	std::size_t final_size() const
+	{
+		if (m_workload.trace.empty())
+		{
+			return m_workload.elements;
+		}
+
+		std::size_t n = 0;
+		for (const auto& op : m_workload.trace)
+		{
+			n += op.op == operation::type::append ? op.value : 0;
+		}
+		return n;
+	}
+
+	void run_synthetic()
+	{
+		for (std::size_t i = 0; i < m_workload.elements; i += batch_size)
+		{
+			const std::size_t count = std::min(batch_size, m_workload.elements - i);
+			append(count);
+
+			const auto start = clock_type::now();
+			for (std::size_t r = 0; r < count * m_workload.reads_per_append; ++r)
+			{
+				read(next_index());
+			}
+			m_read_time += clock_type::now() - start;
+		}
+
+		for (std::size_t s = 0; s < m_workload.scans; ++s)
+		{
+			scan();
+		}
+	}
+
+	void run_trace()
+	{
+		const auto& trace = m_workload.trace;
+		for (std::size_t i = 0; i < trace.size();)
+		{
+			// consecutive reads are timed together
+			if (trace[i].op == operation::type::read)
+			{
+				const auto start = clock_type::now();
+				for (; i < trace.size() && trace[i].op == operation::type::read; ++i)
+				{
+					read(trace[i].value);
+				}
+				m_read_time += clock_type::now() - start;
+				continue;
+			}
+
+			if (trace[i].op == operation::type::append)
+			{
+				append(trace[i].value);
+			}
+			else
+			{
+				scan();
+			}
+			++i;
+		}
+	}
+
+	std::size_t next_index()
+	{
+		const std::size_t size = m_vector.size();
+		if (size == 0)
+		{
+			return 0;
+		}
+
+		switch (m_workload.access)
+		{
+		case access_pattern::none:       return size;
+		case access_pattern::sequential: return m_cursor++;
+		case access_pattern::random:     return m_rng();
+		case access_pattern::recent:     return size - 1 - m_rng() % std::min<std::size_t>(size, 64);
+		}
+		return size;
+	}
+
+	void append(std::size_t count)
+	{
+		const auto start = clock_type::now();
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			m_vector.emplace_back(m_appends + i);
+		}
+		m_append_time += clock_type::now() - start;
+		m_appends += count;
+	}
+
+	// not timed: reads are timed by batches
+	void read(std::size_t index)
+	{
+		const std::size_t size = m_vector.size();
+		if (size == 0 || m_workload.access == access_pattern::none)
+		{
+			return;
+		}
+
+		m_checksum += static_cast<std::size_t>(m_vector[index % size].data[0]);
+		++m_reads;
+	}
+
+	// Appends as many elements as the workload to a fresh container, with the same allocation
+	// policy, timing each append.
+	void sample_latencies()
+	{
+		const std::size_t count = final_size();
+		stable_vector<T, ChunkSize> v;
+		if (m_reserved)
+		{
+			v.reserve(count);
+		}
+
+		m_latencies.reserve(count);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const auto start = clock_type::now();
+			v.emplace_back(i);
+			const auto elapsed = clock_type::now() - start;
+			m_latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		}
+		do_not_optimize(v.back());
+	}
+
+	void scan()
+	{
+		const auto start = clock_type::now();
+		for (const auto& t : m_vector)
+		{
+			m_checksum += static_cast<std::size_t>(t.data[0]);
+		}
+		m_scan_time += clock_type::now() - start;
+		m_scanned += m_vector.size();
+	}
+
+	double percentile(double p) const
+	{
+		if (m_latencies.empty())
+		{
+			return 0;
+		}
+		return static_cast<double>(m_latencies[static_cast<std::size_t>(p * static_cast<double>(m_latencies.size() - 1))]);
+	}
+
+	const workload& m_workload;
+	memory_budget m_budget;
+	bool m_reserved;
+	stable_vector<T, ChunkSize> m_vector;
+
+	std::mt19937_64 m_rng{42};
+	std::size_t m_cursor = 0;
+	std::size_t m_checksum = 0;
+
+	std::size_t m_appends = 0;
+	std::size_t m_reads = 0;
+	std::size_t m_scanned = 0;
+	clock_type::duration m_append_time{};
+	clock_type::duration m_read_time{};
+	clock_type::duration m_scan_time{};
+	std::vector<long long> m_latencies;
+};
+
+template <class T, std::size_t ChunkSize>
+void run_candidate(const workload& w)
+{
+	static const char* policies[] = {"on_demand", "reserved"};
+
+	for (auto policy : {allocation_policy::on_demand, allocation_policy::reserved})
+	{
+		runner<T, ChunkSize> r(w, policy);
+		const result res = r.run();
+
+		std::printf("%6zu %7zu %10s %12.2f %12.2f %10.2f %10.1f %8.0f %8.0f %8.0f %10.0f\n",
+			sizeof(T), ChunkSize, policies[static_cast<int>(policy)],
+			res.append_mops, res.read_mops, res.scan_gbs, res.overhead,
+			res.p50, res.p99, res.p999, res.max);
+
+		do_not_optimize(r.checksum());
+	}
+}
+
+template <class T, std::size_t... ChunkSizes>
+void run_candidates(const workload& w, std::index_sequence<ChunkSizes...>)
+{
+	using expand = int[];
+	(void)expand{0, (run_candidate<T, std::size_t(64) << (2 * ChunkSizes)>(w), 0)...};
+}
+
+template <std::size_t Bytes>
+void run_element_size(const workload& w)
+{
+	// 64, 256, 1024, 4096, 16384, 65536
+	run_candidates<payload<Bytes>>(w, std::make_index_sequence<6>());
+}
+
+std::vector<operation> load_trace(const char* path)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		throw std::runtime_error(std::string("cannot open trace file ") + path);
+	}
+
+	std::vector<operation> ops;
+	std::string op;
+	while (in >> op)
+	{
+		std::size_t value = 0;
+		if (op == "append" && in >> value)
+		{
+			ops.push_back({operation::type::append, value});
+		}
+		else if (op == "read" && in >> value)
+		{
+			ops.push_back({operation::type::read, value});
+		}
+		else if (op == "scan")
+		{
+			ops.push_back({operation::type::scan, 0});
+		}
+		else
+		{
+			throw std::runtime_error("invalid trace operation: " + op);
+		}
+	}
+	return ops;
+}
+
+access_pattern parse_access(const std::string& s)
+{
+	if (s == "none")       return access_pattern::none;
+	if (s == "sequential") return access_pattern::sequential;
+	if (s == "random")     return access_pattern::random;
+	if (s == "recent")     return access_pattern::recent;
+	throw std::runtime_error("invalid access pattern: " + s);
+}
+
+workload parse_args(int argc, char** argv)
+{
+	workload w;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (i + 1 == argc)
+		{
+			throw std::runtime_error("missing value for " + arg);
+		}
+
+		const char* value = argv[++i];
+		if (arg == "--elements")              w.elements = std::strtoull(value, nullptr, 10);
+		else if (arg == "--element-size")     w.element_size = std::strtoull(value, nullptr, 10);
+		else if (arg == "--access")           w.access = parse_access(value);
+		else if (arg == "--reads-per-append") w.reads_per_append = std::strtoull(value, nullptr, 10);
+		else if (arg == "--scans")            w.scans = std::strtoull(value, nullptr, 10);
+		else if (arg == "--trace")            w.trace = load_trace(value);
+		else throw std::runtime_error("unknown option " + arg);
+	}
+	return w;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	workload w;
+	try
+	{
+		w = parse_args(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::printf("%6s %7s %10s %12s %12s %10s %10s %8s %8s %8s %10s\n",
+		"elem", "chunk", "policy", "append Mop/s", "read Mop/s", "scan GB/s", "overhead%", "p50 ns", "p99 ns", "p999 ns", "max ns");
+
+	switch (w.element_size)
+	{
+	case 8:   run_element_size<8>(w); break;
+	case 16:  run_element_size<16>(w); break;
+	case 32:  run_element_size<32>(w); break;
+	case 64:  run_element_size<64>(w); break;
+	case 128: run_element_size<128>(w); break;
+	case 256: run_element_size<256>(w); break;
+	default:
+		std::cerr << "unsupported element size " << w.element_size << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
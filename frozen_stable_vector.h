@@ -0,0 +1,394 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <system_error>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Read-only container produced by stable_vector::freeze(). It owns the chunks of the original
+// container, so references to elements of full chunks remain valid, unless the pages are protected:
+// the elements are then moved to a page-aligned mapping. Every chunk but the last one is full, and
+// all the member functions are const: the container can be read from any number of threads without
+// synchronization.
+template <class T, std::size_t ChunkSize, class Allocator>
+class frozen_stable_vector
+{
+public:
+	using value_type = T;
+	using reference = const value_type&;
+	using const_reference = const value_type&;
+	using pointer = const value_type*;
+	using const_pointer = const value_type*;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using allocator_type = Allocator;
+
+	static constexpr const std::size_t chunk_size = ChunkSize;
+
+private:
+	using __self = frozen_stable_vector<T, ChunkSize, Allocator>;
+
+public:
+	struct const_iterator :
+		public boost::random_access_iterator_helper<const_iterator, const value_type>
+	{
+		const_iterator(const __self* c = nullptr, size_type i = 0) :
+			m_container(c),
+			m_index(i)
+		{}
+
+		const_iterator& operator+=(size_type i) { m_index += i; return *this; }
+		const_iterator& operator-=(size_type i) { m_index -= i; return *this; }
+		const_iterator& operator++()            { ++m_index; return *this; }
+		const_iterator& operator--()            { --m_index; return *this; }
+
+		difference_type operator-(const const_iterator& it) { assert(m_container == it.m_container); return m_index - it.m_index; }
+
+		bool operator< (const const_iterator& it) const { assert(m_container == it.m_container); return m_index < it.m_index; }
+		bool operator==(const const_iterator& it) const { return m_container == it.m_container && m_index == it.m_index; }
+
+		const_reference operator*() const { return (*m_container)[m_index]; }
+
+	private:
+		const __self* m_container;
+		size_type m_index;
+	};
+
+	using iterator = const_iterator;
+
+	frozen_stable_vector() = default;
+	template <class Observer>
+	frozen_stable_vector(stable_vector<T, ChunkSize, Allocator, Observer>&& v, freeze_options options = freeze_options());
+
+	frozen_stable_vector(const frozen_stable_vector&) = delete;
+	frozen_stable_vector& operator=(const frozen_stable_vector&) = delete;
+
+	frozen_stable_vector(frozen_stable_vector&& other) noexcept { swap(other); }
+	frozen_stable_vector& operator=(frozen_stable_vector&& other) noexcept { frozen_stable_vector(std::move(other)).swap(*this); return *this; }
+
+	~frozen_stable_vector();
+
+	void swap(__self& v) noexcept;
+
+	const_iterator begin() const noexcept { return {this, 0}; }
+	const_iterator cbegin() const noexcept { return begin(); }
+
+	const_iterator end() const noexcept { return {this, size()}; }
+	const_iterator cend() const noexcept { return end(); }
+
+	size_type size() const noexcept { return m_size; }
+	bool empty() const noexcept { return m_size == 0; }
+
+	const_reference front() const { return (*this)[0]; }
+	const_reference back() const { return (*this)[m_size - 1]; }
+
+	const_reference operator[](size_type i) const { return m_data[i / ChunkSize][i % ChunkSize]; }
+	const_reference at(size_type i) const;
+
+	size_type chunk_count() const noexcept { return m_data.size(); }
+	size_type chunk_length(size_type c) const noexcept { return c + 1 < m_data.size() ? ChunkSize : m_size - c * ChunkSize; }
+	const_pointer chunk_data(size_type c) const noexcept { return m_data[c]; }
+
+	// True if the element storage has been made read-only: any write to an element raises SIGSEGV.
+	bool is_protected() const noexcept { return m_protected; }
+
+	// Calls f on every element; the loop over a chunk is a plain pointer loop.
+	template <class F>
+	void for_each(F&& f) const;
+
+	bool operator==(const __self& c) const { return size() == c.size() && std::equal(cbegin(), cend(), c.cbegin()); }
+	bool operator!=(const __self& c) const { return !operator==(c); }
+
+private:
+	using chunk_ptr = typename stable_vector<T, ChunkSize, Allocator>::chunk_ptr;
+	using tail_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+	using tail_allocator_traits = std::allocator_traits<tail_allocator>;
+
+	void shrink_tail(std::vector<chunk_ptr>& chunks);
+
+	// moves the elements to a read-only mapping, chunk c starting at element c * ChunkSize
+	void move_to_protected_pages(std::vector<chunk_ptr>& chunks);
+
+	// frees the tail and the mapping
+	void release() noexcept;
+
+	std::vector<chunk_ptr> m_chunks;
+	std::vector<const T*> m_data;
+	size_type m_size = 0;
+
+	T* m_tail = nullptr;
+	size_type m_tail_size = 0;
+	tail_allocator m_tail_allocator;
+
+	T* m_mapping = nullptr;
+	size_type m_mapping_bytes = 0;
+	size_type m_mapped_size = 0;
+	bool m_protected = false;
+
+	// charged for the tail and the mapping
+	memory_budget* m_budget = nullptr;
+};
+
+
+
+
+
+
+template <class T, std::size_t ChunkSize, class Allocator>
+constexpr const std::size_t frozen_stable_vector<T, ChunkSize, Allocator>::chunk_size;
+
+template <class T, std::size_t ChunkSize, class Allocator>
+template <class Observer>
+frozen_stable_vector<T, ChunkSize, Allocator>::frozen_stable_vector(stable_vector<T, ChunkSize, Allocator, Observer>&& v, freeze_options options) :
+	m_size(v.size()),
+	m_tail_allocator(v.m_allocator),
+	m_budget(v.m_budget)
+{
+	assert(!v.in_batch());
+
+	// chunks reserved beyond the last element are not needed anymore
+	const size_type used_chunks = (m_size + ChunkSize - 1) / ChunkSize;
+	v.m_chunks.erase(v.m_chunks.begin() + static_cast<difference_type>(used_chunks), v.m_chunks.end());
+
+	// the destructor does not run if the constructor throws
+	try
+	{
+		if (options.protect_pages)
+		{
+			// heap chunks share their first and last pages with other allocations
+			move_to_protected_pages(v.m_chunks);
+		}
+		else
+		{
+			if (options.shrink_tail && m_size % ChunkSize != 0)
+			{
+				shrink_tail(v.m_chunks);
+			}
+
+			for (auto& chunk : v.m_chunks)
+			{
+				m_data.push_back(chunk->data());
+				m_chunks.push_back(std::move(chunk));
+			}
+
+			if (m_tail_size)
+			{
+				m_data.push_back(m_tail);
+			}
+		}
+	}
+	catch (...)
+	{
+		release();
+		throw;
+	}
+
+	v.clear();
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+void frozen_stable_vector<T, ChunkSize, Allocator>::shrink_tail(std::vector<chunk_ptr>& chunks)
+{
+	auto& last = *chunks.back();
+	if (m_budget)
+	{
+		m_budget->acquire(last.size() * sizeof(T));
+	}
+
+	m_tail_size = last.size();
+	try
+	{
+		m_tail = tail_allocator_traits::allocate(m_tail_allocator, m_tail_size);
+	}
+	catch (...)
+	{
+		if (m_budget)
+		{
+			m_budget->release(m_tail_size * sizeof(T));
+		}
+		m_tail_size = 0;
+		throw;
+	}
+
+	size_type constructed = 0;
+	try
+	{
+		for (; constructed < m_tail_size; ++constructed)
+		{
+			tail_allocator_traits::construct(m_tail_allocator, m_tail + constructed, std::move_if_noexcept(last[constructed]));
+		}
+	}
+	catch (...)
+	{
+		while (constructed > 0)
+		{
+			tail_allocator_traits::destroy(m_tail_allocator, m_tail + --constructed);
+		}
+		tail_allocator_traits::deallocate(m_tail_allocator, m_tail, m_tail_size);
+		if (m_budget)
+		{
+			m_budget->release(m_tail_size * sizeof(T));
+		}
+		m_tail = nullptr;
+		m_tail_size = 0;
+		throw;
+	}
+
+	chunks.pop_back();
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+void frozen_stable_vector<T, ChunkSize, Allocator>::move_to_protected_pages(std::vector<chunk_ptr>& chunks)
+{
+	if (m_size == 0)
+	{
+		return;
+	}
+
+	const auto page = static_cast<size_type>(sysconf(_SC_PAGESIZE));
+	const size_type bytes = (m_size * sizeof(T) + page - 1) / page * page;
+	if (m_budget)
+	{
+		m_budget->acquire(bytes);
+	}
+
+	void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+	{
+		const int error = errno;
+		if (m_budget)
+		{
+			m_budget->release(bytes);
+		}
+		throw std::system_error(error, std::generic_category(), "frozen_stable_vector: mmap");
+	}
+	m_mapping = static_cast<T*>(mapping);
+	m_mapping_bytes = bytes;
+
+	// the protection is tried on the empty mapping first: once the elements are moved, failing would
+	// leave the ones of the caller moved-from
+	if (mprotect(mapping, bytes, PROT_READ) != 0 || mprotect(mapping, bytes, PROT_READ | PROT_WRITE) != 0)
+	{
+		throw std::system_error(errno, std::generic_category(), "frozen_stable_vector: mprotect");
+	}
+
+	for (auto& chunk : chunks)
+	{
+		m_data.push_back(m_mapping + m_mapped_size);
+		for (auto& t : *chunk)
+		{
+			new (m_mapping + m_mapped_size) T(std::move_if_noexcept(t));
+			++m_mapped_size;
+		}
+	}
+
+	if (mprotect(mapping, bytes, PROT_READ) != 0)
+	{
+		throw std::system_error(errno, std::generic_category(), "frozen_stable_vector: mprotect");
+	}
+	m_protected = true;
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+void frozen_stable_vector<T, ChunkSize, Allocator>::release() noexcept
+{
+	if (m_mapping)
+	{
+		if (m_protected)
+		{
+			mprotect(m_mapping, m_mapping_bytes, PROT_READ | PROT_WRITE);
+		}
+		for (size_type i = 0; i < m_mapped_size; ++i)
+		{
+			m_mapping[i].~T();
+		}
+		munmap(m_mapping, m_mapping_bytes);
+		if (m_budget)
+		{
+			m_budget->release(m_mapping_bytes);
+		}
+	}
+
+	if (m_tail)
+	{
+		for (size_type i = 0; i < m_tail_size; ++i)
+		{
+			tail_allocator_traits::destroy(m_tail_allocator, m_tail + i);
+		}
+		tail_allocator_traits::deallocate(m_tail_allocator, m_tail, m_tail_size);
+		if (m_budget)
+		{
+			m_budget->release(m_tail_size * sizeof(T));
+		}
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+frozen_stable_vector<T, ChunkSize, Allocator>::~frozen_stable_vector()
+{
+	release();
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+void frozen_stable_vector<T, ChunkSize, Allocator>::swap(__self& v) noexcept
+{
+	std::swap(m_chunks, v.m_chunks);
+	std::swap(m_data, v.m_data);
+	std::swap(m_size, v.m_size);
+	std::swap(m_tail, v.m_tail);
+	std::swap(m_tail_size, v.m_tail_size);
+	std::swap(m_tail_allocator, v.m_tail_allocator);
+	std::swap(m_mapping, v.m_mapping);
+	std::swap(m_mapping_bytes, v.m_mapping_bytes);
+	std::swap(m_mapped_size, v.m_mapped_size);
+	std::swap(m_protected, v.m_protected);
+	std::swap(m_budget, v.m_budget);
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+typename frozen_stable_vector<T, ChunkSize, Allocator>::const_reference
+frozen_stable_vector<T, ChunkSize, Allocator>::at(size_type i) const
+{
+	if (likely_false(i >= size()))
+	{
+		throw std::out_of_range("frozen_stable_vector::at");
+	}
+
+	return (*this)[i];
+}
+
+template <class T, std::size_t ChunkSize, class Allocator>
+template <class F>
+void frozen_stable_vector<T, ChunkSize, Allocator>::for_each(F&& f) const
+{
+	if (empty())
+	{
+		return;
+	}
+
+	const size_type last = m_data.size() - 1;
+	for (size_type c = 0; c < last; ++c)
+	{
+		for (const T* p = m_data[c], *end = p + ChunkSize; p != end; ++p)
+		{
+			f(*p);
+		}
+	}
+
+	for (const T* p = m_data[last], *end = p + chunk_length(last); p != end; ++p)
+	{
+		f(*p);
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+frozen_stable_vector<T, ChunkSize, Allocator> stable_vector<T, ChunkSize, Allocator, Observer>::freeze(freeze_options options)
+{
+	return frozen_stable_vector<T, ChunkSize, Allocator>(std::move(*this), options);
+}
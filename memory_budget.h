@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+
+struct memory_budget_exceeded : std::bad_alloc
+{
+	const char* what() const noexcept override { return "memory_budget_exceeded"; }
+};
+
+// Byte budget shared by one or several containers. Memory is acquired when a container allocates a
+// chunk and released when the chunk is freed, so the budget is checked once per chunk rather than
+// on every append.
+class memory_budget
+{
+public:
+	enum class policy
+	{
+		fail,    // throw memory_budget_exceeded
+		block,   // wait until enough memory is released by another thread, or the timeout expires
+		callback // let the callback free memory or raise the limit, then retry
+	};
+
+	// Called with the number of bytes requested when the budget is exhausted. Returns true to retry the
+	// allocation, false to fail it.
+	using callback_type = std::function<bool(std::size_t)>;
+
+	// With policy::block, an allocation larger than the limit fails immediately, and one which waits
+	// longer than block_timeout fails with memory_budget_exceeded. Without a timeout, a thread waits
+	// forever unless another thread releases memory or raises the limit.
+	explicit memory_budget(std::size_t limit, policy p = policy::fail, std::chrono::milliseconds block_timeout = std::chrono::milliseconds::max()) :
+		m_limit(limit),
+		m_policy(p),
+		m_block_timeout(block_timeout)
+	{
+	}
+
+	memory_budget(std::size_t limit, callback_type callback) :
+		m_limit(limit),
+		m_policy(policy::callback),
+		m_callback(std::move(callback))
+	{
+	}
+
+	memory_budget(const memory_budget&) = delete;
+	memory_budget& operator=(const memory_budget&) = delete;
+
+	void acquire(std::size_t bytes);
+	bool try_acquire(std::size_t bytes);
+	void release(std::size_t bytes) noexcept;
+
+	std::size_t used() const;
+	std::size_t limit() const;
+	void set_limit(std::size_t limit);
+
+	// Budget charged by containers which are not given one explicitly, none by default.
+	static memory_budget* global() noexcept { return global_instance().load(std::memory_order_acquire); }
+	static void set_global(memory_budget* budget) noexcept { global_instance().store(budget, std::memory_order_release); }
+
+private:
+	static std::atomic<memory_budget*>& global_instance() noexcept
+	{
+		static std::atomic<memory_budget*> instance{nullptr};
+		return instance;
+	}
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_released;
+	std::size_t m_used = 0;
+	std::size_t m_limit;
+	policy m_policy;
+	std::chrono::milliseconds m_block_timeout = std::chrono::milliseconds::max();
+	callback_type m_callback;
+};
+
+inline void memory_budget::acquire(std::size_t bytes)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::chrono::steady_clock::time_point deadline;
+	if (m_policy == policy::block && m_block_timeout != std::chrono::milliseconds::max())
+	{
+		deadline = std::chrono::steady_clock::now() + m_block_timeout;
+	}
+
+	while (m_used + bytes > m_limit)
+	{
+		switch (m_policy)
+		{
+		case policy::fail:
+			throw memory_budget_exceeded();
+
+		case policy::block:
+			// releasing memory cannot satisfy a request larger than the limit
+			if (bytes > m_limit)
+			{
+				throw memory_budget_exceeded();
+			}
+
+			if (m_block_timeout == std::chrono::milliseconds::max())
+			{
+				m_released.wait(lock);
+			}
+			else if (m_released.wait_until(lock, deadline) == std::cv_status::timeout && m_used + bytes > m_limit)
+			{
+				throw memory_budget_exceeded();
+			}
+			break;
+
+		case policy::callback:
+			lock.unlock();
+			if (!m_callback(bytes))
+			{
+				throw memory_budget_exceeded();
+			}
+			lock.lock();
+			break;
+		}
+	}
+
+	m_used += bytes;
+}
+
+inline bool memory_budget::try_acquire(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_used + bytes > m_limit)
+	{
+		return false;
+	}
+
+	m_used += bytes;
+	return true;
+}
+
+inline void memory_budget::release(std::size_t bytes) noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_used -= bytes;
+	}
+	m_released.notify_all();
+}
+
+inline std::size_t memory_budget::used() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_used;
+}
+
+inline std::size_t memory_budget::limit() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_limit;
+}
+
+inline void memory_budget::set_limit(std::size_t limit)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_limit = limit;
+	}
+	m_released.notify_all();
+}
@@ -0,0 +1,422 @@
+// Simulates a long-running process creating and destroying many stable_vectors of varying sizes and
+// lifetimes, and tracks RSS, heap fragmentation and allocation counts over time for three chunk
+// allocation strategies:
+//   default - chunks come from operator new
+//   pool    - freed chunks are kept on a free list and reused, never returned to the heap
+//   arena   - chunks are carved from 1MB arenas, an arena being freed once all its chunks are
+//
+// usage: rss_benchmark [--mode default|pool|arena|all] [--iterations N] [--containers N]
+//                      [--max-size N] [--max-lifetime N] [--report-every N] [--header 0|1]
+//
+// Results are printed as CSV: mode,iteration,live_elements,rss_mb,heap_used_mb,heap_free_mb,
+// fragmentation_pct,allocations,deallocations
+
+#include "stable_vector.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+std::atomic<std::size_t> g_deallocations{0};
+
+}
+
+void* operator new(std::size_t n)
+{
+	++g_allocations;
+	if (void* p = std::malloc(n ? n : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	if (p)
+	{
+		++g_deallocations;
+		std::free(p);
+	}
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+namespace {
+
+// Keeps freed blocks on a per-size free list.
+class free_list_pool
+{
+public:
+	static void* allocate(std::size_t bytes)
+	{
+		auto& list = instance(bytes);
+		if (list.empty())
+		{
+			return ::operator new(bytes);
+		}
+
+		void* p = list.back();
+		list.pop_back();
+		return p;
+	}
+
+	static void deallocate(void* p, std::size_t bytes)
+	{
+		instance(bytes).push_back(p);
+	}
+
+private:
+	static std::vector<void*>& instance(std::size_t bytes)
+	{
+		static std::vector<std::pair<std::size_t, std::vector<void*>>> lists;
+		for (auto& list : lists)
+		{
+			if (list.first == bytes)
+			{
+				return list.second;
+			}
+		}
+
+		lists.emplace_back(bytes, std::vector<void*>());
+		return lists.back().second;
+	}
+};
+
+template <class T>
+struct pool_allocator
+{
+	using value_type = T;
+
+	pool_allocator() = default;
+	template <class U> pool_allocator(const pool_allocator<U>&) {}
+
+	T* allocate(std::size_t n) { return static_cast<T*>(free_list_pool::allocate(n * sizeof(T))); }
+	void deallocate(T* p, std::size_t n) { free_list_pool::deallocate(p, n * sizeof(T)); }
+
+	template <class U> bool operator==(const pool_allocator<U>&) const { return true; }
+	template <class U> bool operator!=(const pool_allocator<U>&) const { return false; }
+};
+
+// Bump allocation from 1MB arenas. Each allocation is prefixed by a pointer to its arena, which is
+// freed when its last allocation is and it is no longer the current arena.
+class arena_pool
+{
+public:
+	static void* allocate(std::size_t bytes)
+	{
+		bytes = (bytes + header_size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+		arena*& a = current();
+		if (!a || a->used + bytes > a->capacity)
+		{
+			retire(a);
+			const std::size_t capacity = bytes > arena_size ? bytes : arena_size;
+			a = new (::operator new(sizeof(arena) + capacity)) arena{capacity, 0, 0};
+		}
+
+		char* p = a->data() + a->used;
+		a->used += bytes;
+		++a->live;
+
+		*reinterpret_cast<arena**>(p) = a;
+		return p + header_size;
+	}
+
+	static void deallocate(void* p)
+	{
+		arena* a = *reinterpret_cast<arena**>(static_cast<char*>(p) - header_size);
+		if (--a->live == 0 && a != current())
+		{
+			::operator delete(a);
+		}
+	}
+
+private:
+	static constexpr std::size_t arena_size = 1 << 20;
+	static constexpr std::size_t header_size = alignof(std::max_align_t);
+
+	struct alignas(std::max_align_t) arena
+	{
+		std::size_t capacity;
+		std::size_t used;
+		std::size_t live;
+
+		char* data() { return reinterpret_cast<char*>(this + 1); }
+	};
+
+	static arena*& current()
+	{
+		static arena* a = nullptr;
+		return a;
+	}
+
+	static void retire(arena* a)
+	{
+		if (a && a->live == 0)
+		{
+			::operator delete(a);
+		}
+	}
+};
+
+template <class T>
+struct arena_allocator
+{
+	using value_type = T;
+
+	arena_allocator() = default;
+	template <class U> arena_allocator(const arena_allocator<U>&) {}
+
+	T* allocate(std::size_t n) { return static_cast<T*>(arena_pool::allocate(n * sizeof(T))); }
+	void deallocate(T* p, std::size_t) { arena_pool::deallocate(p); }
+
+	template <class U> bool operator==(const arena_allocator<U>&) const { return true; }
+	template <class U> bool operator!=(const arena_allocator<U>&) const { return false; }
+};
+
+struct options
+{
+	std::string mode = "all";
+	std::size_t iterations = 5000000;
+	std::size_t containers = 4096;
+	std::size_t max_size = 1 << 14;
+	std::size_t max_lifetime = 1 << 20;
+	std::size_t report_every = 250000;
+	bool header = true;
+};
+
+struct heap_stats
+{
+	double used_mb = 0;
+	double free_mb = 0;
+};
+
+double rss_mb()
+{
+	long pages = 0;
+	long resident = 0;
+	if (FILE* f = std::fopen("/proc/self/statm", "r"))
+	{
+		if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		{
+			resident = 0;
+		}
+		std::fclose(f);
+	}
+	return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+heap_stats heap()
+{
+	heap_stats stats;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	const struct mallinfo2 info = mallinfo2();
+	stats.used_mb = static_cast<double>(info.uordblks + info.hblkhd) / (1 << 20);
+	stats.free_mb = static_cast<double>(info.fordblks) / (1 << 20);
+#endif
+	return stats;
+}
+
+// Log-uniform in [1, max]: most containers are small and short-lived, a few are large and long-lived.
+std::size_t skewed(std::mt19937_64& rng, std::size_t max)
+{
+	std::uniform_real_distribution<double> d(0, std::log(static_cast<double>(max)));
+	return static_cast<std::size_t>(std::exp(d(rng)));
+}
+
+template <class Vector>
+void run(const char* mode, const options& opt)
+{
+	struct slot
+	{
+		Vector v;
+		std::size_t target = 0;
+		std::size_t expiry = 0;
+	};
+
+	std::mt19937_64 rng(42);
+	std::vector<slot> slots(opt.containers);
+	std::size_t live_elements = 0;
+
+	for (std::size_t it = 1; it <= opt.iterations; ++it)
+	{
+		slot& s = slots[rng() % slots.size()];
+
+		if (s.expiry <= it)
+		{
+			live_elements -= s.v.size();
+			s.v = Vector();
+			s.target = skewed(rng, opt.max_size);
+			s.expiry = it + skewed(rng, opt.max_lifetime);
+		}
+
+		// containers grow progressively, interleaving their chunk allocations
+		for (std::size_t n = 0; n < 64 && s.v.size() < s.target; ++n)
+		{
+			s.v.push_back(it);
+			++live_elements;
+		}
+
+		if (it % opt.report_every == 0)
+		{
+			const heap_stats h = heap();
+			const double total = h.used_mb + h.free_mb;
+			std::printf("%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%zu,%zu\n",
+				mode, it, live_elements, rss_mb(), h.used_mb, h.free_mb, total > 0 ? h.free_mb / total * 100 : 0,
+				g_allocations.load(), g_deallocations.load());
+			std::fflush(stdout);
+		}
+	}
+}
+
+options parse_args(int argc, char** argv)
+{
+	options opt;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (i + 1 == argc)
+		{
+			throw std::runtime_error("missing value for " + arg);
+		}
+
+		const char* value = argv[++i];
+
+		if (arg == "--mode")              opt.mode = value;
+		else if (arg == "--iterations")   opt.iterations = std::strtoull(value, nullptr, 10);
+		else if (arg == "--containers")   opt.containers = std::strtoull(value, nullptr, 10);
+		else if (arg == "--max-size")     opt.max_size = std::strtoull(value, nullptr, 10);
+		else if (arg == "--max-lifetime") opt.max_lifetime = std::strtoull(value, nullptr, 10);
+		else if (arg == "--report-every") opt.report_every = std::strtoull(value, nullptr, 10);
+		else if (arg == "--header")       opt.header = std::strcmp(value, "0") != 0;
+		else throw std::runtime_error("unknown option " + arg);
+	}
+
+	if (opt.containers == 0 || opt.report_every == 0)
+	{
+		throw std::runtime_error("--containers and --report-every must be positive");
+	}
+	return opt;
+}
+
+// Runs the benchmark in a child process, without going through a shell.
+bool run_child(const char* program, const options& opt, const char* mode)
+{
+	const std::vector<std::string> args = {
+		program, "--mode", mode,
+		"--iterations", std::to_string(opt.iterations),
+		"--containers", std::to_string(opt.containers),
+		"--max-size", std::to_string(opt.max_size),
+		"--max-lifetime", std::to_string(opt.max_lifetime),
+		"--report-every", std::to_string(opt.report_every),
+		"--header", "0"};
+
+	std::vector<char*> argv;
+	for (const auto& arg : args)
+	{
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	std::fflush(stdout);
+	const pid_t pid = fork();
+	if (pid < 0)
+	{
+		std::perror("fork");
+		return false;
+	}
+	if (pid == 0)
+	{
+		execvp(program, argv.data());
+		std::perror("execvp");
+		_exit(127);
+	}
+
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			std::perror("waitpid");
+			return false;
+		}
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+constexpr std::size_t chunk_size = 512;
+
+}
+
+int main(int argc, char** argv)
+{
+	options opt;
+	try
+	{
+		opt = parse_args(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (opt.header)
+	{
+		std::printf("mode,iteration,live_elements,rss_mb,heap_used_mb,heap_free_mb,fragmentation_pct,allocations,deallocations\n");
+	}
+
+	// each mode runs in a fresh process to start from a clean heap
+	if (opt.mode == "default")
+	{
+		run<stable_vector<std::size_t, chunk_size>>("default", opt);
+	}
+	else if (opt.mode == "pool")
+	{
+		run<stable_vector<std::size_t, chunk_size, pool_allocator<std::size_t>>>("pool", opt);
+	}
+	else if (opt.mode == "arena")
+	{
+		run<stable_vector<std::size_t, chunk_size, arena_allocator<std::size_t>>>("arena", opt);
+	}
+	else if (opt.mode == "all")
+	{
+		for (const char* mode : {"default", "pool", "arena"})
+		{
+			if (!run_child(argv[0], opt, mode))
+			{
+				return 1;
+			}
+		}
+	}
+	else
+	{
+		std::cerr << "unknown mode " << opt.mode << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef likely_false
+#define likely_false(x) __builtin_expect((x), 0)
+#endif
+
+namespace multi_vector_detail {
+
+// Bump allocator of arrays of U, carved from chunks of ChunkSize elements; arrays larger than a chunk
+// get their own allocation. Memory is only returned when the arena is destroyed.
+template <class U, std::size_t ChunkSize>
+class arena
+{
+public:
+	using size_type = std::size_t;
+
+	U* allocate(size_type n)
+	{
+		if (n > ChunkSize)
+		{
+			m_dedicated.emplace_back(new storage[n]);
+			m_bytes += n * sizeof(U);
+			return reinterpret_cast<U*>(m_dedicated.back().get());
+		}
+
+		// the end of the current chunk is lost if too small
+		if (m_chunks.empty() || m_used + n > ChunkSize)
+		{
+			m_chunks.emplace_back(new storage[ChunkSize]);
+			m_bytes += ChunkSize * sizeof(U);
+			m_used = 0;
+		}
+
+		U* p = reinterpret_cast<U*>(m_chunks.back().get() + m_used);
+		m_used += n;
+		return p;
+	}
+
+	// Bytes allocated from the heap.
+	size_type memory_used() const noexcept { return m_bytes; }
+
+private:
+	using storage = typename std::aligned_storage<sizeof(U), alignof(U)>::type;
+
+	std::vector<std::unique_ptr<storage[]>> m_chunks;
+	std::vector<std::unique_ptr<storage[]>> m_dedicated;
+	size_type m_used = 0;
+	size_type m_bytes = 0;
+};
+
+}
+
+// Many small append-only vectors sharing one arena. A vector grows by segments of FirstSegment,
+// 2 * FirstSegment, 4 * FirstSegment, ... elements up to ChunkSize, then by segments of ChunkSize
+// elements; segments are carved from shared chunks of ChunkSize elements. As with stable_vector,
+// elements never move, and indexing is O(1): the segment holding an element follows from its index.
+//
+// A vector costs a small header and a directory of segment pointers, also carved from the arena, so
+// that a vector of 3 elements takes a few dozen bytes instead of a full chunk.
+template <class T, std::size_t ChunkSize = 1024, std::size_t FirstSegment = 4>
+class stable_multi_vector
+{
+	static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize needs to be a power of 2");
+	static_assert((FirstSegment & (FirstSegment - 1)) == 0 && FirstSegment <= ChunkSize, "FirstSegment needs to be a power of 2, not greater than ChunkSize");
+
+public:
+	using value_type = T;
+	using reference = value_type&;
+	using const_reference = const value_type&;
+	using size_type = std::size_t;
+	using vector_id = std::size_t;
+
+	static constexpr const std::size_t chunk_size = ChunkSize;
+
+	template <class Container, class Value>
+	class basic_vector_ref;
+
+	using vector_ref = basic_vector_ref<stable_multi_vector, T>;
+	using const_vector_ref = basic_vector_ref<const stable_multi_vector, const T>;
+
+	stable_multi_vector() = default;
+	~stable_multi_vector();
+
+	stable_multi_vector(const stable_multi_vector&) = delete;
+	stable_multi_vector& operator=(const stable_multi_vector&) = delete;
+
+	stable_multi_vector(stable_multi_vector&& other) noexcept { swap(other); }
+	stable_multi_vector& operator=(stable_multi_vector&& other) noexcept { stable_multi_vector(std::move(other)).swap(*this); return *this; }
+
+	void swap(stable_multi_vector& other) noexcept;
+
+	// Adds an empty vector, returning its id: ids are consecutive, starting from 0.
+	vector_id create();
+
+	size_type vector_count() const noexcept { return m_vectors.size(); }
+
+	vector_ref operator[](vector_id id) noexcept { return {this, id}; }
+	const_vector_ref operator[](vector_id id) const noexcept { return {this, id}; }
+
+	size_type size(vector_id id) const noexcept { return m_vectors[id].size; }
+
+	void push_back(vector_id id, const T& t) { emplace_back(id, t); }
+	void push_back(vector_id id, T&& t) { emplace_back(id, std::move(t)); }
+
+	template <class... Args>
+	void emplace_back(vector_id id, Args&&... args);
+
+	reference get(vector_id id, size_type i) noexcept;
+	const_reference get(vector_id id, size_type i) const noexcept { return const_cast<stable_multi_vector&>(*this).get(id, i); }
+
+	// Bytes allocated for the elements, the directories and the vector headers.
+	size_type memory_used() const noexcept;
+
+private:
+	struct header
+	{
+		T** segments = nullptr;
+		size_type size = 0;
+		uint32_t segment_count = 0;
+		uint32_t segment_capacity = 0;
+	};
+
+	static constexpr size_type log2(size_type n) { return n <= 1 ? 0 : 1 + log2(n / 2); }
+
+	// segments up to geometric_segments - 1 grow geometrically and hold geometric_size elements
+	static constexpr size_type geometric_segments = log2(ChunkSize / FirstSegment) + 1;
+	static constexpr size_type geometric_size = FirstSegment * ((size_type(1) << geometric_segments) - 1);
+
+	static size_type segment_size(size_type s) noexcept { return s < geometric_segments ? FirstSegment << s : ChunkSize; }
+
+	// segment holding element i, and offset of the element in the segment
+	static std::pair<size_type, size_type> locate(size_type i) noexcept;
+
+	multi_vector_detail::arena<T, ChunkSize> m_elements;
+	multi_vector_detail::arena<T*, ChunkSize> m_directories;
+	std::vector<header> m_vectors;
+};
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+template <class Container, class Value>
+class stable_multi_vector<T, ChunkSize, FirstSegment>::basic_vector_ref
+{
+public:
+	class iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = typename stable_multi_vector::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = Value*;
+		using reference = Value&;
+
+		iterator(Container* c = nullptr, vector_id id = 0, size_type i = 0) :
+			m_container(c),
+			m_id(id),
+			m_index(i)
+		{}
+
+		reference operator*() const { return m_container->get(m_id, m_index); }
+		pointer operator->() const { return &**this; }
+
+		iterator& operator++() { ++m_index; return *this; }
+		iterator operator++(int) { iterator it = *this; ++m_index; return it; }
+
+		bool operator==(const iterator& it) const { return m_index == it.m_index; }
+		bool operator!=(const iterator& it) const { return m_index != it.m_index; }
+
+	private:
+		Container* m_container;
+		vector_id m_id;
+		size_type m_index;
+	};
+
+	basic_vector_ref(Container* c, vector_id id) :
+		m_container(c),
+		m_id(id)
+	{}
+
+	size_type size() const noexcept { return m_container->size(m_id); }
+	bool empty() const noexcept { return size() == 0; }
+
+	Value& operator[](size_type i) const noexcept { return m_container->get(m_id, i); }
+
+	Value& at(size_type i) const
+	{
+		if (likely_false(i >= size()))
+		{
+			throw std::out_of_range("stable_multi_vector::at");
+		}
+		return (*this)[i];
+	}
+
+	Value& front() const noexcept { return (*this)[0]; }
+	Value& back() const noexcept { return (*this)[size() - 1]; }
+
+	iterator begin() const noexcept { return {m_container, m_id, 0}; }
+	iterator end() const noexcept { return {m_container, m_id, size()}; }
+
+	template <class U = Value, class = std::enable_if_t<!std::is_const<U>::value>>
+	void push_back(const T& t) const { m_container->push_back(m_id, t); }
+
+	template <class U = Value, class = std::enable_if_t<!std::is_const<U>::value>>
+	void push_back(T&& t) const { m_container->push_back(m_id, std::move(t)); }
+
+	template <class... Args>
+	void emplace_back(Args&&... args) const { m_container->emplace_back(m_id, std::forward<Args>(args)...); }
+
+private:
+	Container* m_container;
+	vector_id m_id;
+};
+
+
+
+
+
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+constexpr const std::size_t stable_multi_vector<T, ChunkSize, FirstSegment>::chunk_size;
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+constexpr const typename stable_multi_vector<T, ChunkSize, FirstSegment>::size_type stable_multi_vector<T, ChunkSize, FirstSegment>::geometric_segments;
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+constexpr const typename stable_multi_vector<T, ChunkSize, FirstSegment>::size_type stable_multi_vector<T, ChunkSize, FirstSegment>::geometric_size;
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+stable_multi_vector<T, ChunkSize, FirstSegment>::~stable_multi_vector()
+{
+	if (std::is_trivially_destructible<T>::value)
+	{
+		return;
+	}
+
+	for (const header& h : m_vectors)
+	{
+		for (size_type s = 0, first = 0; first < h.size; first += segment_size(s), ++s)
+		{
+			const size_type count = std::min(segment_size(s), h.size - first);
+			for (size_type i = 0; i < count; ++i)
+			{
+				h.segments[s][i].~T();
+			}
+		}
+	}
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+void stable_multi_vector<T, ChunkSize, FirstSegment>::swap(stable_multi_vector& other) noexcept
+{
+	std::swap(m_elements, other.m_elements);
+	std::swap(m_directories, other.m_directories);
+	std::swap(m_vectors, other.m_vectors);
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+typename stable_multi_vector<T, ChunkSize, FirstSegment>::vector_id stable_multi_vector<T, ChunkSize, FirstSegment>::create()
+{
+	m_vectors.emplace_back();
+	return m_vectors.size() - 1;
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+std::pair<std::size_t, std::size_t> stable_multi_vector<T, ChunkSize, FirstSegment>::locate(size_type i) noexcept
+{
+	if (i < geometric_size)
+	{
+		// segment s starts at FirstSegment * (2^s - 1)
+		const size_type s = static_cast<size_type>(63 - __builtin_clzll(i / FirstSegment + 1));
+		return {s, i - FirstSegment * ((size_type(1) << s) - 1)};
+	}
+
+	const size_type j = i - geometric_size;
+	return {geometric_segments + j / ChunkSize, j % ChunkSize};
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+typename stable_multi_vector<T, ChunkSize, FirstSegment>::reference
+stable_multi_vector<T, ChunkSize, FirstSegment>::get(vector_id id, size_type i) noexcept
+{
+	const auto location = locate(i);
+	return m_vectors[id].segments[location.first][location.second];
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+template <class... Args>
+void stable_multi_vector<T, ChunkSize, FirstSegment>::emplace_back(vector_id id, Args&&... args)
+{
+	header& h = m_vectors[id];
+	const auto location = locate(h.size);
+
+	if (location.first == h.segment_count)
+	{
+		if (h.segment_count == h.segment_capacity)
+		{
+			// the previous directory is left in the arena: directories are small
+			const uint32_t capacity = h.segment_capacity ? 2 * h.segment_capacity : 1;
+			T** segments = m_directories.allocate(capacity);
+			std::copy(h.segments, h.segments + h.segment_count, segments);
+			h.segments = segments;
+			h.segment_capacity = capacity;
+		}
+
+		h.segments[h.segment_count] = m_elements.allocate(segment_size(location.first));
+		++h.segment_count;
+	}
+
+	new (h.segments[location.first] + location.second) T(std::forward<Args>(args)...);
+	++h.size;
+}
+
+template <class T, std::size_t ChunkSize, std::size_t FirstSegment>
+typename stable_multi_vector<T, ChunkSize, FirstSegment>::size_type stable_multi_vector<T, ChunkSize, FirstSegment>::memory_used() const noexcept
+{
+	return m_elements.memory_used() + m_directories.memory_used() + m_vectors.capacity() * sizeof(header);
+}
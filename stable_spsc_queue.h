@@ -0,0 +1,254 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Lock-free single-producer/single-consumer queue made of chunks, like stable_vector: elements are
+// constructed in place and never move, so the consumer can keep references to the elements it
+// popped until it calls release(). Released chunks go back to the producer through a free list, so
+// a queue in a steady state does not allocate.
+//
+// The producer pushes elements, which become visible to the consumer on publish(): publishing a
+// batch costs a single release store. The producer and consumer state live on separate cache lines.
+template <class T, std::size_t ChunkSize = 1024>
+class stable_spsc_queue
+{
+	static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize needs to be a power of 2");
+
+public:
+	using value_type = T;
+	using reference = value_type&;
+	using size_type = std::size_t;
+
+	static constexpr const std::size_t chunk_size = ChunkSize;
+
+	stable_spsc_queue();
+	~stable_spsc_queue();
+
+	stable_spsc_queue(const stable_spsc_queue&) = delete;
+	stable_spsc_queue& operator=(const stable_spsc_queue&) = delete;
+
+	// Producer: appends an element, not visible to the consumer until the next publish().
+	void push(const T& t) { emplace(t); }
+	void push(T&& t) { emplace(std::move(t)); }
+
+	template <class... Args>
+	void emplace(Args&&... args);
+
+	// Producer: makes the elements pushed so far visible to the consumer.
+	void publish() noexcept { m_published.store(m_tail, std::memory_order_release); }
+
+	// Consumer: next published element, or nullptr if there is none.
+	T* front() noexcept;
+
+	// Consumer: moves past the element returned by front(), which stays alive until release().
+	void pop() noexcept;
+
+	// Consumer: destroys the popped elements, and hands the chunks they occupied back to the producer.
+	void release() noexcept;
+
+	// Consumer: number of published elements not popped yet.
+	size_type read_available() const noexcept { return m_published.load(std::memory_order_acquire) - m_head; }
+
+private:
+	struct chunk
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[ChunkSize];
+		std::atomic<chunk*> next{nullptr};
+		chunk* free_next = nullptr;
+
+		T* slot(size_type i) noexcept { return reinterpret_cast<T*>(&slots[i]); }
+	};
+
+	static constexpr std::size_t cache_line = 64;
+
+	chunk* acquire_chunk();
+	void recycle(chunk* c) noexcept;
+	static void delete_list(chunk* c) noexcept;
+
+	// producer
+	alignas(cache_line) chunk* m_tail_chunk;
+	size_type m_tail = 0;
+	chunk* m_free = nullptr;
+
+	alignas(cache_line) std::atomic<size_type> m_published{0};
+	alignas(cache_line) std::atomic<chunk*> m_recycled{nullptr};
+
+	// consumer; m_*_base is the index of the first slot of the matching chunk
+	alignas(cache_line) chunk* m_head_chunk;
+	size_type m_head_base = 0;
+	size_type m_head = 0;
+	size_type m_published_cache = 0;
+	chunk* m_release_chunk;
+	size_type m_release_base = 0;
+	size_type m_released = 0;
+};
+
+
+
+
+
+
+template <class T, std::size_t ChunkSize>
+constexpr const std::size_t stable_spsc_queue<T, ChunkSize>::chunk_size;
+
+template <class T, std::size_t ChunkSize>
+stable_spsc_queue<T, ChunkSize>::stable_spsc_queue() :
+	m_tail_chunk(new chunk),
+	m_head_chunk(m_tail_chunk),
+	m_release_chunk(m_tail_chunk)
+{
+}
+
+template <class T, std::size_t ChunkSize>
+stable_spsc_queue<T, ChunkSize>::~stable_spsc_queue()
+{
+	// the producer and the consumer are both done: their chunks form a single list
+	chunk* c = m_release_chunk;
+	size_type base = m_release_base;
+	for (size_type i = m_released; i < m_tail; ++i)
+	{
+		if (i == base + ChunkSize)
+		{
+			c = c->next.load(std::memory_order_relaxed);
+			base = i;
+		}
+		c->slot(i - base)->~T();
+	}
+
+	delete_list(m_free);
+	delete_list(m_recycled.load(std::memory_order_acquire));
+
+	for (chunk* next; m_release_chunk; m_release_chunk = next)
+	{
+		next = m_release_chunk->next.load(std::memory_order_relaxed);
+		delete m_release_chunk;
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_spsc_queue<T, ChunkSize>::delete_list(chunk* c) noexcept
+{
+	for (chunk* next; c; c = next)
+	{
+		next = c->free_next;
+		delete c;
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+typename stable_spsc_queue<T, ChunkSize>::chunk* stable_spsc_queue<T, ChunkSize>::acquire_chunk()
+{
+	if (!m_free)
+	{
+		m_free = m_recycled.exchange(nullptr, std::memory_order_acquire);
+	}
+
+	if (!m_free)
+	{
+		return new chunk;
+	}
+
+	chunk* c = m_free;
+	m_free = c->free_next;
+	c->next.store(nullptr, std::memory_order_relaxed);
+	return c;
+}
+
+template <class T, std::size_t ChunkSize>
+template <class... Args>
+void stable_spsc_queue<T, ChunkSize>::emplace(Args&&... args)
+{
+	const size_type offset = m_tail % ChunkSize;
+	if (offset == 0 && m_tail != 0)
+	{
+		// the element is constructed before the chunk is linked, so that the chunk goes back to the
+		// free list if the constructor throws
+		chunk* c = acquire_chunk();
+		try
+		{
+			new (c->slot(0)) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			c->free_next = m_free;
+			m_free = c;
+			throw;
+		}
+
+		// the consumer follows the link only after the next publish(), which orders it
+		m_tail_chunk->next.store(c, std::memory_order_relaxed);
+		m_tail_chunk = c;
+	}
+	else
+	{
+		new (m_tail_chunk->slot(offset)) T(std::forward<Args>(args)...);
+	}
+	++m_tail;
+}
+
+template <class T, std::size_t ChunkSize>
+T* stable_spsc_queue<T, ChunkSize>::front() noexcept
+{
+	if (m_head == m_published_cache)
+	{
+		m_published_cache = m_published.load(std::memory_order_acquire);
+		if (m_head == m_published_cache)
+		{
+			return nullptr;
+		}
+	}
+
+	// the element is published, so is the link to the chunk holding it
+	if (m_head == m_head_base + ChunkSize)
+	{
+		m_head_chunk = m_head_chunk->next.load(std::memory_order_relaxed);
+		m_head_base = m_head;
+	}
+	return m_head_chunk->slot(m_head - m_head_base);
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_spsc_queue<T, ChunkSize>::pop() noexcept
+{
+	assert(m_head < m_published_cache && m_head < m_head_base + ChunkSize);
+	++m_head;
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_spsc_queue<T, ChunkSize>::release() noexcept
+{
+	for (;;)
+	{
+		// once the consumer has moved to the next chunk, so has the producer
+		if (m_released == m_release_base + ChunkSize && m_release_base < m_head_base)
+		{
+			chunk* done = m_release_chunk;
+			m_release_chunk = done->next.load(std::memory_order_relaxed);
+			m_release_base = m_released;
+			recycle(done);
+		}
+		else if (m_released < m_head)
+		{
+			m_release_chunk->slot(m_released - m_release_base)->~T();
+			++m_released;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_spsc_queue<T, ChunkSize>::recycle(chunk* c) noexcept
+{
+	c->free_next = m_recycled.load(std::memory_order_relaxed);
+	while (!m_recycled.compare_exchange_weak(c->free_next, c, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+}
@@ -7,15 +7,142 @@
 #include <iterator>
 #include <algorithm>
 #include <numeric>
+#include <limits>
+#include <stdexcept>
+#include <cassert>
+#include <cstring>
 
+#include "memory_budget.h"
+
+#include <boost/core/empty_value.hpp>
 #include <boost/operators.hpp>
 #include <boost/container/static_vector.hpp>
 
 #define likely_false(x) __builtin_expect((x), 0)
 #define likely_true(x)  __builtin_expect((x), 1)
 
-template <class T, std::size_t ChunkSize = 1024>
-class stable_vector
+// Contiguous elements of a chunk.
+template <class T>
+struct chunk_span
+{
+	T* data() const noexcept { return m_data; }
+	std::size_t size() const noexcept { return m_size; }
+	bool empty() const noexcept { return m_size == 0; }
+
+	T* begin() const noexcept { return m_data; }
+	T* end() const noexcept { return m_data + m_size; }
+
+	T& operator[](std::size_t i) const noexcept { return m_data[i]; }
+
+	T* m_data;
+	std::size_t m_size;
+};
+
+struct freeze_options
+{
+	// moves the elements of the last, partially filled chunk to an allocation of the exact size
+	bool shrink_tail = true;
+
+	// moves the elements to page-aligned memory made read-only; references to them are not kept,
+	// and shrink_tail does not apply
+	bool protect_pages = false;
+};
+
+template <class T, std::size_t ChunkSize, class Allocator>
+class frozen_stable_vector;
+
+namespace parallel_detail { struct chunk_access; }
+
+// Observer of the elements appended to a stable_vector; its hooks are empty inline functions, which
+// compile to nothing. Observers only overriding some hooks can derive from it.
+struct null_observer
+{
+	// Element index has been appended.
+	template <class T>
+	void on_append(std::size_t /* index */, const T& /* element */) noexcept {}
+
+	// Chunk c has been allocated, to append elements or by reserve().
+	void on_chunk_added(std::size_t /* c */) noexcept {}
+
+	// Chunk c is full: its chunk_size elements, starting at data, will not change anymore.
+	template <class T>
+	void on_chunk_sealed(std::size_t /* c */, const T* /* data */) noexcept {}
+
+	// A batch has been rolled back: the elements from new_size on do not exist anymore.
+	void on_rollback(std::size_t /* new_size */) noexcept {}
+
+	// All the elements have been removed, by clear(), assign() or freeze().
+	void on_clear() noexcept {}
+};
+
+// Forwards the removal of elements to the truncate() of an index, e.g. chunk_bloom_index, bitmap_index
+// or ordered_index. Appended elements are indexed by the next update() of the index, not from
+// on_append(): indexing allocates, which the hooks cannot do. The index is held by address, so
+// copies of the container are attached to the same index.
+class truncating_observer : public null_observer
+{
+public:
+	template <class Index>
+	void attach(Index& index) noexcept
+	{
+		m_index = &index;
+		m_truncate = [](void* i, std::size_t new_size) { static_cast<Index*>(i)->truncate(new_size); };
+	}
+
+	void detach() noexcept { m_index = nullptr; }
+
+	void on_rollback(std::size_t new_size) noexcept
+	{
+		if (m_index)
+		{
+			m_truncate(m_index, new_size);
+		}
+	}
+
+	void on_clear() noexcept { on_rollback(0); }
+
+private:
+	void* m_index = nullptr;
+	void (*m_truncate)(void*, std::size_t) = nullptr;
+};
+
+namespace stable_vector_detail {
+
+// Each chunk keeps the allocator and the budget it was allocated from, so chunks can be exchanged
+// between containers without propagating either.
+template <class Chunk, class ChunkAllocator>
+struct chunk_deleter : ChunkAllocator
+{
+	using chunk_allocator_traits = std::allocator_traits<ChunkAllocator>;
+
+	chunk_deleter() = default;
+	chunk_deleter(const ChunkAllocator& alloc, memory_budget* b) :
+		ChunkAllocator(alloc),
+		budget(b)
+	{
+	}
+
+	void operator()(Chunk* chunk) noexcept
+	{
+		chunk_allocator_traits::destroy(*this, chunk);
+		chunk_allocator_traits::deallocate(*this, chunk, 1);
+		if (budget)
+		{
+			budget->release(sizeof(Chunk));
+		}
+	}
+
+	memory_budget* budget = nullptr;
+};
+
+}
+
+// The observer is called inline on every append, clear() and rollback(); its hooks must not throw.
+// It is part of the container's state: it is copied, moved and swapped along with the elements, except
+// by copy assignment. An empty observer is an empty base, which takes no space.
+template <class T, std::size_t ChunkSize = 1024, class Allocator = std::allocator<T>, class Observer = null_observer>
+class stable_vector :
+	private boost::empty_value<Observer>
 {
 public:
 	using value_type = T;
@@ -25,6 +152,7 @@ public:
 	using const_pointer = const value_type*;
 	using size_type = std::size_t;
 	using difference_type = std::ptrdiff_t;
+	using allocator_type = Allocator;
 
 	static constexpr const std::size_t chunk_size = ChunkSize;
 
@@ -34,8 +162,8 @@ private:
 
 	static_assert(is_pow2<ChunkSize>::value, "ChunkSize needs to be a power of 2");
 
-	using __self = stable_vector<T, ChunkSize>;
-	using __const_self = const stable_vector<T, ChunkSize>;
+	using __self = stable_vector<T, ChunkSize, Allocator, Observer>;
+	using __const_self = const stable_vector<T, ChunkSize, Allocator, Observer>;
 
 	template <class Container>
 	struct iterator_base
@@ -95,6 +223,7 @@ public:
 	};
 
 	stable_vector() = default;
+	explicit stable_vector(const allocator_type& alloc);
 	explicit stable_vector(size_type count, const T& value);
 	explicit stable_vector(size_type count);
 
@@ -107,7 +236,20 @@ public:
 	stable_vector(const stable_vector& other);
 	stable_vector(stable_vector&& other) noexcept;
 
-	stable_vector& operator=(stable_vector v);
+	// Copy assignment and assign() reuse the chunks already allocated: live elements are assigned over,
+	// only the difference is constructed or destroyed, and trivially copyable elements are copied with
+	// memcpy. Chunks no longer needed are kept as reserved capacity. Copy assignment only copies the
+	// committed elements, and keeps the observer of this container, notified as by assign().
+	stable_vector& operator=(const stable_vector& other);
+	stable_vector& operator=(stable_vector&& other) noexcept;
+
+	// Replaces the elements: the observer is notified of a clear, then of every element as appended.
+	template <class InputIt,
+			  class = std::enable_if_t<std::is_convertible<typename std::iterator_traits<InputIt>::iterator_category, std::input_iterator_tag>::value>>
+	void assign(InputIt first, InputIt last);
+
+	void assign(size_type count, const T& value);
+	void assign(std::initializer_list<T> ilist) { assign(ilist.begin(), ilist.end()); }
 
 	iterator begin() noexcept { return {this, 0}; }
 	const_iterator begin() const noexcept { return {this, 0}; }
@@ -117,11 +259,11 @@ public:
 	const_iterator end() const noexcept { return {this, size()}; }
 	const_iterator cend() const noexcept { return end(); }
 
-	size_type size() const noexcept { return empty() ? 0 : (m_chunks.size() - 1) * ChunkSize + m_chunks.back()->size(); }
+	size_type size() const noexcept { return std::min(m_size, m_batch_begin); }
 	size_type max_size() const noexcept { return std::numeric_limits<size_type>::max(); }
 	size_type capacity() const noexcept { return m_chunks.size() * ChunkSize; }
 
-	bool empty() const noexcept { return m_chunks.size() == 0; }
+	bool empty() const noexcept { return size() == 0; }
 
 	void reserve(size_type new_capacity);
 	void shrink_to_fit() noexcept {}
@@ -129,15 +271,15 @@ public:
 	bool operator==(const __self& c) const { return size() == c.size() && std::equal(cbegin(), cend(), c.cbegin()); }
 	bool operator!=(const __self& c) const { return !operator==(c); }
 
-	void swap(__self& v) { std::swap(m_chunks, v.m_chunks); }
+	void swap(__self& v) { swap_elements(v); std::swap(m_budget, v.m_budget); std::swap(m_allocator, v.m_allocator); }
 
 	friend void swap(__self& l, __self& r) { l.swap(r); }
 
-	reference front()             { return m_chunks.front()->front(); }
-	const_reference front() const { return front(); }
+	reference front()             { return (*this)[0]; }
+	const_reference front() const { return (*this)[0]; }
 
-	reference back()             { return m_chunks.back()->back(); }
-	const_reference back() const { return back(); }
+	reference back()             { return (*this)[size() - 1]; }
+	const_reference back() const { return (*this)[size() - 1]; }
 
 	void push_back(const T& t);
 	void push_back(T&& t);
@@ -145,6 +287,31 @@ public:
 	template <class... Args>
 	void emplace_back(Args&&... args);
 
+	void clear() noexcept;
+
+	// Elements appended between begin_batch() and commit() are not part of the container until the batch
+	// is committed: size(), iteration, at() and back() ignore them, although operator[] can reach them.
+	// rollback() destroys them and frees the chunks allocated by the batch.
+	void begin_batch() noexcept;
+	void commit() noexcept { m_batch_begin = no_batch; }
+	void rollback() noexcept;
+
+	bool in_batch() const noexcept { return m_batch_begin != no_batch; }
+	size_type batch_size() const noexcept { return in_batch() ? m_size - m_batch_begin : 0; }
+
+	// Chunks allocated from now on are charged to the given budget, which must outlive them.
+	memory_budget* get_memory_budget() const noexcept { return m_budget; }
+	void set_memory_budget(memory_budget* budget) noexcept { m_budget = budget; }
+
+	allocator_type get_allocator() const { return allocator_type(m_allocator); }
+
+	Observer& get_observer() noexcept { return boost::empty_value<Observer>::get(); }
+	const Observer& get_observer() const noexcept { return boost::empty_value<Observer>::get(); }
+
+	// Moves the elements to a read-only container, leaving this one empty. References to elements
+	// remain valid, except those to the last chunk when options.shrink_tail is set.
+	frozen_stable_vector<T, ChunkSize, Allocator> freeze(freeze_options options = freeze_options());
+
 	reference operator[](size_type i);
 
 	const_reference operator[](size_type i) const;
@@ -153,14 +320,68 @@ public:
 
 	const_reference at(size_type i) const;
 
+	size_type chunk_count() const noexcept { return m_chunks.size(); }
+	size_type chunk_length(size_type c) const noexcept { return size() > c * ChunkSize ? std::min(ChunkSize, size() - c * ChunkSize) : 0; }
+
+	pointer chunk_data(size_type c) noexcept { return m_chunks[c]->data(); }
+	const_pointer chunk_data(size_type c) const noexcept { return m_chunks[c]->data(); }
+
+	// Calls f(index, element) for every element, the loop over a chunk being a plain pointer loop.
+	template <class F>
+	void for_each_indexed(F&& f);
+
+	template <class F>
+	void for_each_indexed(F&& f) const;
+
+	// Calls f(base_index, span) for every chunk holding elements, span covering its elements.
+	template <class F>
+	void for_each_chunk(F&& f);
+
+	template <class F>
+	void for_each_chunk(F&& f) const;
+
 private:
+	friend class frozen_stable_vector<T, ChunkSize, Allocator>;
+	friend struct parallel_detail::chunk_access;
+
 	using chunk_type = boost::container::static_vector<T, ChunkSize>;
-	using storage_type = std::vector<std::unique_ptr<chunk_type>>;
+
+	using chunk_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<chunk_type>;
+	using chunk_allocator_traits = std::allocator_traits<chunk_allocator>;
+
+	// independent of the observer, so that chunks can move to a frozen_stable_vector
+	using chunk_deleter = stable_vector_detail::chunk_deleter<chunk_type, chunk_allocator>;
+
+	using chunk_ptr = std::unique_ptr<chunk_type, chunk_deleter>;
+	using storage_type = std::vector<chunk_ptr>;
+
+	template <class... Args>
+	chunk_ptr make_chunk(Args&&... args);
 
 	void add_chunk();
 	chunk_type& last_chunk();
+	void appended(const chunk_type& chunk);
+
+	void resize_chunks(size_type size);
+	void truncate(size_type size) noexcept;
+	void notify_assigned(size_type first, size_type last);
+
+	template <class InputIt>
+	void assign_range(InputIt first, InputIt last, std::false_type /* memcpy */);
+	void assign_range(const T* first, const T* last, std::true_type /* memcpy */);
+
+	static void copy_chunk(chunk_type& to, const chunk_type& from, std::false_type /* memcpy */) { to.assign(from.begin(), from.end()); }
+	static void copy_chunk(chunk_type& to, const chunk_type& from, std::true_type /* memcpy */);
+	void swap_elements(__self& v) noexcept;
+
+	static constexpr size_type no_batch = std::numeric_limits<size_type>::max();
 
 	storage_type m_chunks;
+	size_type m_size = 0;
+	size_type m_batch_begin = no_batch;
+	size_type m_batch_chunks = 0;
+	memory_budget* m_budget = memory_budget::global();
+	chunk_allocator m_allocator;
 };
 
 
@@ -169,8 +390,20 @@ private:
 
 
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>::stable_vector(size_type count, const T& value)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+constexpr const std::size_t stable_vector<T, ChunkSize, Allocator, Observer>::chunk_size;
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+constexpr const typename stable_vector<T, ChunkSize, Allocator, Observer>::size_type stable_vector<T, ChunkSize, Allocator, Observer>::no_batch;
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(const allocator_type& alloc) :
+	m_allocator(alloc)
+{
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(size_type count, const T& value)
 {
 	for (size_type i = 0; i < count; ++i)
 	{
@@ -178,8 +411,8 @@ stable_vector<T, ChunkSize>::stable_vector(size_type count, const T& value)
 	}
 }
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>::stable_vector(size_type count)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(size_type count)
 {
 	for (size_type i = 0; i < count; ++i)
 	{
@@ -187,9 +420,9 @@ stable_vector<T, ChunkSize>::stable_vector(size_type count)
 	}
 }
 
-template <class T, std::size_t ChunkSize>
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
 template <class InputIt, class>
-stable_vector<T, ChunkSize>::stable_vector(InputIt first, InputIt last)
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(InputIt first, InputIt last)
 {
 	for (; first != last; ++first)
 	{
@@ -197,23 +430,31 @@ stable_vector<T, ChunkSize>::stable_vector(InputIt first, InputIt last)
 	}
 }
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>::stable_vector(const stable_vector& other)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(const stable_vector& other) :
+	boost::empty_value<Observer>(boost::empty_init_t(), other.get_observer()),
+	m_size(other.m_size),
+	m_batch_begin(other.m_batch_begin),
+	m_batch_chunks(other.m_batch_chunks),
+	m_budget(other.m_budget),
+	m_allocator(chunk_allocator_traits::select_on_container_copy_construction(other.m_allocator))
 {
 	for (const auto& chunk : other.m_chunks)
 	{
-		m_chunks.emplace_back(std::make_unique<chunk_type>(*chunk));
+		m_chunks.push_back(make_chunk(*chunk));
 	}
 }
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>::stable_vector(stable_vector&& other) noexcept :
-	m_chunks(std::move(other.m_chunks))
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(stable_vector&& other) noexcept :
+	m_budget(other.m_budget),
+	m_allocator(std::move(other.m_allocator))
 {
+	swap_elements(other);
 }
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>::stable_vector(std::initializer_list<T> ilist)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>::stable_vector(std::initializer_list<T> ilist)
 {
 	for (const auto& t : ilist)
 	{
@@ -221,32 +462,263 @@ stable_vector<T, ChunkSize>::stable_vector(std::initializer_list<T> ilist)
 	}
 }
 
-template <class T, std::size_t ChunkSize>
-stable_vector<T, ChunkSize>& stable_vector<T, ChunkSize>::operator=(stable_vector v)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>& stable_vector<T, ChunkSize, Allocator, Observer>::operator=(const stable_vector& other)
+{
+	if (this == &other)
+	{
+		return *this;
+	}
+
+	// elements of an open batch of other are not copied, and an open batch of this one is dropped
+	const size_type size = other.size();
+	const size_type chunks = (size + ChunkSize - 1) / ChunkSize;
+	for (size_type c = 0; c < chunks; ++c)
+	{
+		if (c == m_chunks.size())
+		{
+			m_chunks.push_back(make_chunk(*other.m_chunks[c]));
+		}
+		else
+		{
+			copy_chunk(*m_chunks[c], *other.m_chunks[c], std::is_trivially_copyable<T>());
+		}
+	}
+
+	truncate(size);
+	m_batch_begin = no_batch;
+	m_batch_chunks = m_chunks.size();
+
+	get_observer().on_clear();
+	notify_assigned(0, size);
+	return *this;
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+stable_vector<T, ChunkSize, Allocator, Observer>& stable_vector<T, ChunkSize, Allocator, Observer>::operator=(stable_vector&& other) noexcept
 {
-	swap(v);
+	// the previous elements are destroyed along with v
+	stable_vector v(std::move(other));
+	swap_elements(v);
 	return *this;
 }
 
-template <class T, std::size_t ChunkSize>
-void stable_vector<T, ChunkSize>::add_chunk()
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::copy_chunk(chunk_type& to, const chunk_type& from, std::true_type)
+{
+	to.resize(from.size(), boost::container::default_init);
+	std::memcpy(to.data(), from.data(), from.size() * sizeof(T));
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class InputIt, class>
+void stable_vector<T, ChunkSize, Allocator, Observer>::assign(InputIt first, InputIt last)
+{
+	assert(!in_batch());
+	get_observer().on_clear();
+	assign_range(first, last, std::integral_constant<bool, std::is_convertible<InputIt, const T*>::value && std::is_trivially_copyable<T>::value>());
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class InputIt>
+void stable_vector<T, ChunkSize, Allocator, Observer>::assign_range(InputIt first, InputIt last, std::false_type)
+{
+	size_type i = 0;
+	for (; first != last && i < m_size; ++first, ++i)
+	{
+		(*this)[i] = *first;
+	}
+	notify_assigned(0, i);
+
+	if (first == last)
+	{
+		truncate(i);
+		return;
+	}
+
+	for (; first != last; ++first)
+	{
+		push_back(*first);
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::assign_range(const T* first, const T* last, std::true_type)
 {
-	m_chunks.emplace_back(std::make_unique<chunk_type>());
+	const size_type size = static_cast<size_type>(last - first);
+	resize_chunks(size);
+
+	for (size_type c = 0; c * ChunkSize < size; ++c)
+	{
+		const size_type length = std::min(ChunkSize, size - c * ChunkSize);
+		m_chunks[c]->resize(length, boost::container::default_init);
+		std::memcpy(m_chunks[c]->data(), first + c * ChunkSize, length * sizeof(T));
+	}
+
+	truncate(size);
+	notify_assigned(0, size);
 }
 
-template <class T, std::size_t ChunkSize>
-typename stable_vector<T, ChunkSize>::chunk_type& stable_vector<T, ChunkSize>::last_chunk()
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::assign(size_type count, const T& value)
 {
-	if (likely_false(m_chunks.empty() || m_chunks.back()->size() == ChunkSize))
+	assert(!in_batch());
+	get_observer().on_clear();
+	resize_chunks(count);
+
+	for (size_type c = 0; c * ChunkSize < count; ++c)
+	{
+		chunk_type& chunk = *m_chunks[c];
+		const size_type length = std::min(ChunkSize, count - c * ChunkSize);
+
+		std::fill_n(chunk.data(), std::min(length, chunk.size()), value);
+		chunk.resize(length, value);
+	}
+
+	truncate(count);
+	notify_assigned(0, count);
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::resize_chunks(size_type size)
+{
+	while (m_chunks.size() * ChunkSize < size)
 	{
 		add_chunk();
 	}
+}
 
-	return *m_chunks.back();
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::truncate(size_type size) noexcept
+{
+	for (size_type c = size / ChunkSize; c < m_chunks.size(); ++c)
+	{
+		const size_type length = c == size / ChunkSize ? size % ChunkSize : 0;
+		while (m_chunks[c]->size() > length)
+		{
+			m_chunks[c]->pop_back();
+		}
+	}
+	m_size = size;
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::notify_assigned(size_type first, size_type last)
+{
+	for (size_type i = first; i < last; ++i)
+	{
+		get_observer().on_append(i, (*this)[i]);
+		if ((i + 1) % ChunkSize == 0)
+		{
+			get_observer().on_chunk_sealed(i / ChunkSize, m_chunks[i / ChunkSize]->data());
+		}
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::swap_elements(__self& v) noexcept
+{
+	std::swap(m_chunks, v.m_chunks);
+	std::swap(m_size, v.m_size);
+	std::swap(m_batch_begin, v.m_batch_begin);
+	std::swap(m_batch_chunks, v.m_batch_chunks);
+	std::swap(get_observer(), v.get_observer());
 }
 
-template <class T, std::size_t ChunkSize>
-void stable_vector<T, ChunkSize>::reserve(size_type new_capacity)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class... Args>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::chunk_ptr stable_vector<T, ChunkSize, Allocator, Observer>::make_chunk(Args&&... args)
+{
+	if (m_budget)
+	{
+		m_budget->acquire(sizeof(chunk_type));
+	}
+
+	chunk_type* chunk = nullptr;
+	try
+	{
+		chunk = chunk_allocator_traits::allocate(m_allocator, 1);
+		chunk_allocator_traits::construct(m_allocator, chunk, std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+		if (chunk)
+		{
+			chunk_allocator_traits::deallocate(m_allocator, chunk, 1);
+		}
+		if (m_budget)
+		{
+			m_budget->release(sizeof(chunk_type));
+		}
+		throw;
+	}
+
+	return chunk_ptr(chunk, chunk_deleter(m_allocator, m_budget));
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::add_chunk()
+{
+	m_chunks.push_back(make_chunk());
+	get_observer().on_chunk_added(m_chunks.size() - 1);
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::chunk_type& stable_vector<T, ChunkSize, Allocator, Observer>::last_chunk()
+{
+	const size_type chunk = m_size / ChunkSize;
+	if (likely_false(chunk == m_chunks.size()))
+	{
+		add_chunk();
+	}
+
+	return *m_chunks[chunk];
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::appended(const chunk_type& chunk)
+{
+	++m_size;
+	get_observer().on_append(m_size - 1, chunk.back());
+	if (m_size % ChunkSize == 0)
+	{
+		get_observer().on_chunk_sealed(m_size / ChunkSize - 1, chunk.data());
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::clear() noexcept
+{
+	m_chunks.clear();
+	m_size = 0;
+	m_batch_begin = no_batch;
+	get_observer().on_clear();
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::begin_batch() noexcept
+{
+	assert(!in_batch());
+	m_batch_begin = m_size;
+	m_batch_chunks = m_chunks.size();
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::rollback() noexcept
+{
+	assert(in_batch());
+	for (; m_size > m_batch_begin; --m_size)
+	{
+		m_chunks[(m_size - 1) / ChunkSize]->pop_back();
+	}
+
+	m_chunks.erase(m_chunks.begin() + static_cast<difference_type>(m_batch_chunks), m_chunks.end());
+	m_batch_begin = no_batch;
+	get_observer().on_rollback(m_size);
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::reserve(size_type new_capacity)
 {
 	const std::size_t initial_capacity = capacity();
 	for (difference_type i = new_capacity - initial_capacity; i > 0; i -= ChunkSize)
@@ -255,42 +727,48 @@ void stable_vector<T, ChunkSize>::reserve(size_type new_capacity)
 	}
 }
 
-template <class T, std::size_t ChunkSize>
-void stable_vector<T, ChunkSize>::push_back(const T& t)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::push_back(const T& t)
 {
-	last_chunk().push_back(t);
+	chunk_type& chunk = last_chunk();
+	chunk.push_back(t);
+	appended(chunk);
 }
 
-template <class T, std::size_t ChunkSize>
-void stable_vector<T, ChunkSize>::push_back(T&& t)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+void stable_vector<T, ChunkSize, Allocator, Observer>::push_back(T&& t)
 {
-	last_chunk().push_back(std::move(t));
+	chunk_type& chunk = last_chunk();
+	chunk.push_back(std::move(t));
+	appended(chunk);
 }
 
-template <class T, std::size_t ChunkSize>
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
 template <class... Args>
-void stable_vector<T, ChunkSize>::emplace_back(Args&&... args)
+void stable_vector<T, ChunkSize, Allocator, Observer>::emplace_back(Args&&... args)
 {
-	last_chunk().emplace_back(std::forward<Args>(args)...);
+	chunk_type& chunk = last_chunk();
+	chunk.emplace_back(std::forward<Args>(args)...);
+	appended(chunk);
 }
 
-template <class T, std::size_t ChunkSize>
-typename stable_vector<T, ChunkSize>::reference
-stable_vector<T, ChunkSize>::operator[](size_type i)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::reference
+stable_vector<T, ChunkSize, Allocator, Observer>::operator[](size_type i)
 {
 	return (*m_chunks[i / ChunkSize])[i % ChunkSize];
 }
 
-template <class T, std::size_t ChunkSize>
-typename stable_vector<T, ChunkSize>::const_reference
-stable_vector<T, ChunkSize>::operator[](size_type i) const
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::const_reference
+stable_vector<T, ChunkSize, Allocator, Observer>::operator[](size_type i) const
 {
 	return const_cast<__self&>(*this)[i];
 }
 
-template <class T, std::size_t ChunkSize>
-typename stable_vector<T, ChunkSize>::reference
-stable_vector<T, ChunkSize>::at(size_type i)
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::reference
+stable_vector<T, ChunkSize, Allocator, Observer>::at(size_type i)
 {
 	if (likely_false(i >= size()))
 	{
@@ -300,10 +778,61 @@ stable_vector<T, ChunkSize>::at(size_type i)
 	return operator[](i);
 }
 
-template <class T, std::size_t ChunkSize>
-typename stable_vector<T, ChunkSize>::const_reference
-stable_vector<T, ChunkSize>::at(size_type i) const
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+typename stable_vector<T, ChunkSize, Allocator, Observer>::const_reference
+stable_vector<T, ChunkSize, Allocator, Observer>::at(size_type i) const
 {
 	return const_cast<__self&>(*this).at(i);
 }
 
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class F>
+void stable_vector<T, ChunkSize, Allocator, Observer>::for_each_chunk(F&& f)
+{
+	const size_type size = this->size();
+	for (size_type c = 0, base = 0; base < size; ++c, base += ChunkSize)
+	{
+		f(base, chunk_span<T>{m_chunks[c]->data(), std::min(ChunkSize, size - base)});
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class F>
+void stable_vector<T, ChunkSize, Allocator, Observer>::for_each_chunk(F&& f) const
+{
+	const size_type size = this->size();
+	for (size_type c = 0, base = 0; base < size; ++c, base += ChunkSize)
+	{
+		f(base, chunk_span<const T>{m_chunks[c]->data(), std::min(ChunkSize, size - base)});
+	}
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class F>
+void stable_vector<T, ChunkSize, Allocator, Observer>::for_each_indexed(F&& f)
+{
+	for_each_chunk([&f](size_type base, chunk_span<T> span)
+	{
+		T* data = span.data();
+		for (size_type i = 0, n = span.size(); i < n; ++i)
+		{
+			f(base + i, data[i]);
+		}
+	});
+}
+
+template <class T, std::size_t ChunkSize, class Allocator, class Observer>
+template <class F>
+void stable_vector<T, ChunkSize, Allocator, Observer>::for_each_indexed(F&& f) const
+{
+	for_each_chunk([&f](size_type base, chunk_span<const T> span)
+	{
+		const T* data = span.data();
+		for (size_type i = 0, n = span.size(); i < n; ++i)
+		{
+			f(base + i, data[i]);
+		}
+	});
+}
+
+#include "frozen_stable_vector.h"
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Arrow C data interface, as specified in https://arrow.apache.org/docs/format/CDataInterface.html
+// The guards allow this header to coexist with arrow/c/abi.h.
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema
+{
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+
+	void (*release)(struct ArrowSchema*);
+	void* private_data;
+};
+
+struct ArrowArray
+{
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+
+	void (*release)(struct ArrowArray*);
+	void* private_data;
+};
+
+}
+
+#endif
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+extern "C" {
+
+struct ArrowArrayStream
+{
+	int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+	int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+	const char* (*get_last_error)(struct ArrowArrayStream*);
+
+	void (*release)(struct ArrowArrayStream*);
+	void* private_data;
+};
+
+}
+
+#endif
+
+// Format string of the Arrow primitive type matching T. Only fixed-width types whose in-memory
+// representation is the Arrow one can be exported without a copy.
+template <class T> struct arrow_format;
+
+template <> struct arrow_format<int8_t>   { static const char* value() { return "c"; } };
+template <> struct arrow_format<uint8_t>  { static const char* value() { return "C"; } };
+template <> struct arrow_format<int16_t>  { static const char* value() { return "s"; } };
+template <> struct arrow_format<uint16_t> { static const char* value() { return "S"; } };
+template <> struct arrow_format<int32_t>  { static const char* value() { return "i"; } };
+template <> struct arrow_format<uint32_t> { static const char* value() { return "I"; } };
+template <> struct arrow_format<int64_t>  { static const char* value() { return "l"; } };
+template <> struct arrow_format<uint64_t> { static const char* value() { return "L"; } };
+template <> struct arrow_format<float>    { static const char* value() { return "f"; } };
+template <> struct arrow_format<double>   { static const char* value() { return "g"; } };
+
+template <class StableVector>
+void export_arrow_schema(ArrowSchema* out);
+
+namespace arrow_detail {
+
+template <class StableVector>
+struct chunk_holder
+{
+	std::shared_ptr<const StableVector> container;
+	const void* buffers[2];
+};
+
+template <class StableVector>
+void release_chunk(ArrowArray* array)
+{
+	delete static_cast<chunk_holder<StableVector>*>(array->private_data);
+	array->release = nullptr;
+}
+
+inline void release_schema(ArrowSchema* schema)
+{
+	schema->release = nullptr;
+}
+
+template <class StableVector>
+void export_chunk(std::shared_ptr<const StableVector> v, const void* data, int64_t length, ArrowArray* out)
+{
+	auto* holder = new chunk_holder<StableVector>{std::move(v), {nullptr, data}};
+
+	out->length = length;
+	out->null_count = 0;
+	out->offset = 0;
+	out->n_buffers = 2;
+	out->n_children = 0;
+	out->buffers = holder->buffers;
+	out->children = nullptr;
+	out->dictionary = nullptr;
+	out->release = &release_chunk<StableVector>;
+	out->private_data = holder;
+}
+
+template <class StableVector>
+struct stream_holder
+{
+	std::shared_ptr<const StableVector> container;
+	std::vector<const void*> chunks;
+	std::size_t size;
+	std::size_t next;
+};
+
+template <class StableVector>
+int stream_get_schema(ArrowArrayStream*, ArrowSchema* out)
+{
+	export_arrow_schema<StableVector>(out);
+	return 0;
+}
+
+template <class StableVector>
+int stream_get_next(ArrowArrayStream* stream, ArrowArray* out)
+{
+	auto& holder = *static_cast<stream_holder<StableVector>*>(stream->private_data);
+	if (holder.next == holder.chunks.size())
+	{
+		out->release = nullptr;
+		return 0;
+	}
+
+	const std::size_t first = holder.next * StableVector::chunk_size;
+	const std::size_t length = std::min(StableVector::chunk_size, holder.size - first);
+	export_chunk(holder.container, holder.chunks[holder.next++], static_cast<int64_t>(length), out);
+	return 0;
+}
+
+inline const char* stream_get_last_error(ArrowArrayStream*)
+{
+	return nullptr;
+}
+
+template <class StableVector>
+void stream_release(ArrowArrayStream* stream)
+{
+	delete static_cast<stream_holder<StableVector>*>(stream->private_data);
+	stream->release = nullptr;
+}
+
+}
+
+// Exports the schema of a stable_vector column: a non-nullable primitive array.
+template <class StableVector>
+void export_arrow_schema(ArrowSchema* out)
+{
+	out->format = arrow_format<typename StableVector::value_type>::value();
+	out->name = "";
+	out->metadata = nullptr;
+	out->flags = 0;
+	out->n_children = 0;
+	out->children = nullptr;
+	out->dictionary = nullptr;
+	out->release = &arrow_detail::release_schema;
+	out->private_data = nullptr;
+}
+
+// Exports one chunk of the container as an Arrow array whose data buffer is the chunk itself.
+// The array holds a reference on the container until it is released.
+template <class StableVector>
+void export_arrow_chunk(std::shared_ptr<const StableVector> v, std::size_t chunk, ArrowArray* out)
+{
+	const void* data = v->chunk_data(chunk);
+	const auto length = static_cast<int64_t>(v->chunk_length(chunk));
+	arrow_detail::export_chunk(std::move(v), data, length, out);
+}
+
+// Exports the container as a chunked array, one Arrow array per chunk, without copying any element.
+// The elements visible through the stream are those present at the time of the call: the container
+// can keep growing meanwhile, but must not be modified otherwise while the stream or any of the
+// arrays it produced are alive.
+template <class StableVector>
+void export_arrow_stream(std::shared_ptr<const StableVector> v, ArrowArrayStream* out)
+{
+	auto* holder = new arrow_detail::stream_holder<StableVector>{std::move(v), {}, 0, 0};
+	holder->size = holder->container->size();
+
+	const std::size_t chunks = (holder->size + StableVector::chunk_size - 1) / StableVector::chunk_size;
+	holder->chunks.reserve(chunks);
+	for (std::size_t c = 0; c < chunks; ++c)
+	{
+		holder->chunks.push_back(holder->container->chunk_data(c));
+	}
+
+	out->get_schema = &arrow_detail::stream_get_schema<StableVector>;
+	out->get_next = &arrow_detail::stream_get_next<StableVector>;
+	out->get_last_error = &arrow_detail::stream_get_last_error;
+	out->release = &arrow_detail::stream_release<StableVector>;
+	out->private_data = holder;
+}
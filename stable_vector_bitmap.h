@@ -0,0 +1,426 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Set of positions within one chunk, stored like a roaring bitmap container: a sorted array of
+// 16-bit offsets while sparse, a plain bitset once it holds more than ChunkSize / 16 positions.
+template <std::size_t ChunkSize>
+class chunk_bitmap
+{
+	static_assert(ChunkSize <= 65536, "offsets within a chunk are stored on 16 bits");
+
+public:
+	using size_type = std::size_t;
+
+	static constexpr std::size_t words = (ChunkSize + 63) / 64;
+	static constexpr std::size_t array_max = ChunkSize / 16;
+
+	bool is_bitset() const noexcept { return !m_bits.empty(); }
+	size_type cardinality() const noexcept { return m_cardinality; }
+	bool empty() const noexcept { return m_cardinality == 0; }
+
+	// Positions must be added in increasing order, which is the case when indexing appended elements.
+	void add(size_type offset);
+	bool contains(size_type offset) const;
+
+	template <class F>
+	void for_each(F&& f) const;
+
+	chunk_bitmap operator&(const chunk_bitmap& b) const;
+	chunk_bitmap operator|(const chunk_bitmap& b) const;
+
+private:
+	void to_bitset();
+	void normalize();
+
+	std::vector<uint16_t> m_array;
+	std::vector<uint64_t> m_bits;
+	size_type m_cardinality = 0;
+};
+
+// Result of a predicate over an indexed container: one chunk_bitmap per chunk. Predicates are
+// combined with & and |, and the result turned into the list of selected indices.
+template <std::size_t ChunkSize>
+class bitmap_selection
+{
+public:
+	using size_type = std::size_t;
+	using bitmap_type = chunk_bitmap<ChunkSize>;
+
+	bitmap_selection() = default;
+	explicit bitmap_selection(std::vector<bitmap_type> chunks) : m_chunks(std::move(chunks)) {}
+
+	bitmap_selection operator&(const bitmap_selection& s) const;
+	bitmap_selection operator|(const bitmap_selection& s) const;
+
+	size_type count() const;
+
+	// Calls f(index) for every selected index, in increasing order.
+	template <class F>
+	void for_each(F&& f) const;
+
+	std::vector<size_type> to_selection_vector() const;
+
+	const std::vector<bitmap_type>& chunks() const noexcept { return m_chunks; }
+
+private:
+	std::vector<bitmap_type> m_chunks;
+};
+
+// Bitmap index over a low-cardinality key of the elements: for each distinct key, one chunk_bitmap
+// per chunk holding the positions of the elements with this key. The index is maintained by calling
+// update() after appending elements, and only covers the elements present at the last update().
+// Removing elements (clear(), rollback(), assign()) requires a call to truncate(), which a
+// truncating_observer attached to the index makes; update() also detects a container smaller than
+// the index.
+template <class StableVector,
+		  class KeyExtractor,
+		  class Hash = std::hash<std::decay_t<std::result_of_t<KeyExtractor(const typename StableVector::value_type&)>>>>
+class bitmap_index
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using key_type = std::decay_t<std::result_of_t<KeyExtractor(const value_type&)>>;
+	using size_type = std::size_t;
+	using selection_type = bitmap_selection<StableVector::chunk_size>;
+
+	static constexpr std::size_t chunk_size = StableVector::chunk_size;
+
+	explicit bitmap_index(KeyExtractor key = KeyExtractor(), Hash hash = Hash()) :
+		m_key(std::move(key)),
+		m_bitmaps(0, std::move(hash))
+	{
+	}
+
+	// Indexes the elements appended to v since the last call.
+	void update(const StableVector& v);
+
+	// Drops the positions of the elements from new_size on: the chunk holding element new_size is
+	// indexed again by the next update().
+	void truncate(size_type new_size);
+
+	// Elements whose key equals the given one.
+	selection_type equal(const key_type& key) const;
+
+	// Elements whose key is any of the given ones.
+	selection_type any_of(std::initializer_list<key_type> keys) const;
+
+	size_type indexed_size() const noexcept { return m_indexed; }
+	size_type distinct_keys() const noexcept { return m_bitmaps.size(); }
+
+private:
+	using bitmap_type = chunk_bitmap<chunk_size>;
+
+	size_type indexed_chunks() const noexcept { return (m_indexed + chunk_size - 1) / chunk_size; }
+
+	KeyExtractor m_key;
+	std::unordered_map<key_type, std::vector<bitmap_type>, Hash> m_bitmaps;
+	size_type m_indexed = 0;
+};
+
+
+
+
+
+
+template <std::size_t ChunkSize>
+void chunk_bitmap<ChunkSize>::add(size_type offset)
+{
+	assert(offset < ChunkSize);
+	if (is_bitset())
+	{
+		m_bits[offset / 64] |= uint64_t(1) << (offset % 64);
+	}
+	else
+	{
+		assert(m_array.empty() || m_array.back() < offset);
+		m_array.push_back(static_cast<uint16_t>(offset));
+		if (m_array.size() > array_max)
+		{
+			to_bitset();
+		}
+	}
+	++m_cardinality;
+}
+
+template <std::size_t ChunkSize>
+bool chunk_bitmap<ChunkSize>::contains(size_type offset) const
+{
+	if (is_bitset())
+	{
+		return m_bits[offset / 64] & (uint64_t(1) << (offset % 64));
+	}
+	return std::binary_search(m_array.begin(), m_array.end(), static_cast<uint16_t>(offset));
+}
+
+template <std::size_t ChunkSize>
+template <class F>
+void chunk_bitmap<ChunkSize>::for_each(F&& f) const
+{
+	if (!is_bitset())
+	{
+		for (uint16_t offset : m_array)
+		{
+			f(static_cast<size_type>(offset));
+		}
+		return;
+	}
+
+	for (size_type w = 0; w < words; ++w)
+	{
+		for (uint64_t word = m_bits[w]; word; word &= word - 1)
+		{
+			f(w * 64 + static_cast<size_type>(__builtin_ctzll(word)));
+		}
+	}
+}
+
+template <std::size_t ChunkSize>
+void chunk_bitmap<ChunkSize>::to_bitset()
+{
+	m_bits.assign(words, 0);
+	for (uint16_t offset : m_array)
+	{
+		m_bits[offset / 64] |= uint64_t(1) << (offset % 64);
+	}
+	m_array.clear();
+	m_array.shrink_to_fit();
+}
+
+template <std::size_t ChunkSize>
+void chunk_bitmap<ChunkSize>::normalize()
+{
+	if (is_bitset() && m_cardinality <= array_max)
+	{
+		std::vector<uint16_t> array;
+		array.reserve(m_cardinality);
+		for_each([&array](size_type offset) { array.push_back(static_cast<uint16_t>(offset)); });
+
+		m_array.swap(array);
+		m_bits.clear();
+		m_bits.shrink_to_fit();
+	}
+	else if (!is_bitset() && m_cardinality > array_max)
+	{
+		to_bitset();
+	}
+}
+
+template <std::size_t ChunkSize>
+chunk_bitmap<ChunkSize> chunk_bitmap<ChunkSize>::operator&(const chunk_bitmap& b) const
+{
+	chunk_bitmap r;
+	if (is_bitset() && b.is_bitset())
+	{
+		r.m_bits.resize(words);
+		for (size_type w = 0; w < words; ++w)
+		{
+			r.m_bits[w] = m_bits[w] & b.m_bits[w];
+			r.m_cardinality += static_cast<size_type>(__builtin_popcountll(r.m_bits[w]));
+		}
+		r.normalize();
+	}
+	else if (is_bitset() || b.is_bitset())
+	{
+		const chunk_bitmap& array = is_bitset() ? b : *this;
+		const chunk_bitmap& bitset = is_bitset() ? *this : b;
+		for (uint16_t offset : array.m_array)
+		{
+			if (bitset.contains(offset))
+			{
+				r.m_array.push_back(offset);
+			}
+		}
+		r.m_cardinality = r.m_array.size();
+	}
+	else
+	{
+		std::set_intersection(m_array.begin(), m_array.end(), b.m_array.begin(), b.m_array.end(), std::back_inserter(r.m_array));
+		r.m_cardinality = r.m_array.size();
+	}
+	return r;
+}
+
+template <std::size_t ChunkSize>
+chunk_bitmap<ChunkSize> chunk_bitmap<ChunkSize>::operator|(const chunk_bitmap& b) const
+{
+	chunk_bitmap r;
+	if (!is_bitset() && !b.is_bitset())
+	{
+		std::set_union(m_array.begin(), m_array.end(), b.m_array.begin(), b.m_array.end(), std::back_inserter(r.m_array));
+		r.m_cardinality = r.m_array.size();
+		r.normalize();
+		return r;
+	}
+
+	r.m_bits.assign(words, 0);
+	for (const chunk_bitmap* s : {this, &b})
+	{
+		if (s->is_bitset())
+		{
+			for (size_type w = 0; w < words; ++w)
+			{
+				r.m_bits[w] |= s->m_bits[w];
+			}
+		}
+		else
+		{
+			for (uint16_t offset : s->m_array)
+			{
+				r.m_bits[offset / 64] |= uint64_t(1) << (offset % 64);
+			}
+		}
+	}
+
+	for (uint64_t word : r.m_bits)
+	{
+		r.m_cardinality += static_cast<size_type>(__builtin_popcountll(word));
+	}
+	return r;
+}
+
+template <std::size_t ChunkSize>
+bitmap_selection<ChunkSize> bitmap_selection<ChunkSize>::operator&(const bitmap_selection& s) const
+{
+	// missing chunks are empty
+	std::vector<bitmap_type> chunks(std::min(m_chunks.size(), s.m_chunks.size()));
+	for (size_type c = 0; c < chunks.size(); ++c)
+	{
+		chunks[c] = m_chunks[c] & s.m_chunks[c];
+	}
+	return bitmap_selection(std::move(chunks));
+}
+
+template <std::size_t ChunkSize>
+bitmap_selection<ChunkSize> bitmap_selection<ChunkSize>::operator|(const bitmap_selection& s) const
+{
+	const bitmap_selection& longest = m_chunks.size() >= s.m_chunks.size() ? *this : s;
+	const bitmap_selection& shortest = m_chunks.size() >= s.m_chunks.size() ? s : *this;
+
+	std::vector<bitmap_type> chunks(longest.m_chunks);
+	for (size_type c = 0; c < shortest.m_chunks.size(); ++c)
+	{
+		chunks[c] = chunks[c] | shortest.m_chunks[c];
+	}
+	return bitmap_selection(std::move(chunks));
+}
+
+template <std::size_t ChunkSize>
+typename bitmap_selection<ChunkSize>::size_type bitmap_selection<ChunkSize>::count() const
+{
+	size_type n = 0;
+	for (const auto& chunk : m_chunks)
+	{
+		n += chunk.cardinality();
+	}
+	return n;
+}
+
+template <std::size_t ChunkSize>
+template <class F>
+void bitmap_selection<ChunkSize>::for_each(F&& f) const
+{
+	for (size_type c = 0; c < m_chunks.size(); ++c)
+	{
+		const size_type base = c * ChunkSize;
+		m_chunks[c].for_each([&f, base](size_type offset) { f(base + offset); });
+	}
+}
+
+template <std::size_t ChunkSize>
+std::vector<typename bitmap_selection<ChunkSize>::size_type> bitmap_selection<ChunkSize>::to_selection_vector() const
+{
+	std::vector<size_type> indices;
+	indices.reserve(count());
+	for_each([&indices](size_type i) { indices.push_back(i); });
+	return indices;
+}
+
+template <class StableVector, class KeyExtractor, class Hash>
+void bitmap_index<StableVector, KeyExtractor, Hash>::update(const StableVector& v)
+{
+	const size_type size = v.size();
+	if (size < m_indexed)
+	{
+		truncate(size);
+	}
+
+	while (m_indexed < size)
+	{
+		const size_type chunk = m_indexed / chunk_size;
+		const size_type end = std::min(size, (chunk + 1) * chunk_size);
+		const value_type* data = v.chunk_data(chunk);
+
+		for (size_type i = m_indexed; i < end; ++i)
+		{
+			auto& bitmaps = m_bitmaps[m_key(data[i - chunk * chunk_size])];
+			if (bitmaps.size() <= chunk)
+			{
+				bitmaps.resize(chunk + 1);
+			}
+			bitmaps[chunk].add(i - chunk * chunk_size);
+		}
+		m_indexed = end;
+	}
+}
+
+template <class StableVector, class KeyExtractor, class Hash>
+void bitmap_index<StableVector, KeyExtractor, Hash>::truncate(size_type new_size)
+{
+	if (new_size >= m_indexed)
+	{
+		return;
+	}
+
+	const size_type chunks = new_size / chunk_size;
+	for (auto it = m_bitmaps.begin(); it != m_bitmaps.end();)
+	{
+		auto& bitmaps = it->second;
+		if (bitmaps.size() > chunks)
+		{
+			bitmaps.resize(chunks);
+		}
+
+		// keys without elements anymore are removed
+		if (std::all_of(bitmaps.begin(), bitmaps.end(), [](const bitmap_type& b) { return b.empty(); }))
+		{
+			it = m_bitmaps.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	m_indexed = chunks * chunk_size;
+}
+
+template <class StableVector, class KeyExtractor, class Hash>
+typename bitmap_index<StableVector, KeyExtractor, Hash>::selection_type
+bitmap_index<StableVector, KeyExtractor, Hash>::equal(const key_type& key) const
+{
+	auto it = m_bitmaps.find(key);
+	if (it == m_bitmaps.end())
+	{
+		return selection_type();
+	}
+	return selection_type(it->second);
+}
+
+template <class StableVector, class KeyExtractor, class Hash>
+typename bitmap_index<StableVector, KeyExtractor, Hash>::selection_type
+bitmap_index<StableVector, KeyExtractor, Hash>::any_of(std::initializer_list<key_type> keys) const
+{
+	selection_type s;
+	for (const auto& key : keys)
+	{
+		s = s | equal(key);
+	}
+	return s;
+}
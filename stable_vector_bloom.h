@@ -0,0 +1,198 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+// One blocked Bloom filter per chunk over a key of the elements, so an equality lookup only scans
+// the chunks whose filter may contain the key.
+//
+// Each filter is split in 512-bit blocks, the size of a cache line: a key sets or tests a few bits
+// of a single block, so probing a chunk costs one cache miss. With the default 10 bits per element,
+// the false positive rate is about 1%.
+//
+// The index is maintained by calling update() after appending elements; elements appended since the
+// last update() are still found by find(), by scanning them. Removing elements (clear(), rollback(),
+// assign()) requires a call to truncate(), which a truncating_observer attached to the index makes;
+// update() also detects a container smaller than the index.
+template <class StableVector,
+		  class KeyExtractor,
+		  std::size_t BitsPerElement = 10,
+		  class Hash = std::hash<std::decay_t<std::result_of_t<KeyExtractor(const typename StableVector::value_type&)>>>>
+class chunk_bloom_index
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using key_type = std::decay_t<std::result_of_t<KeyExtractor(const value_type&)>>;
+	using size_type = std::size_t;
+
+	static constexpr std::size_t chunk_size = StableVector::chunk_size;
+
+	explicit chunk_bloom_index(KeyExtractor key = KeyExtractor(), Hash hash = Hash()) :
+		m_key(std::move(key)),
+		m_hash(std::move(hash))
+	{
+	}
+
+	// Adds to the filters the elements appended to v since the last call.
+	void update(const StableVector& v);
+
+	// Drops the filters covering elements from new_size on: the chunk holding element new_size is
+	// indexed again by the next update().
+	void truncate(size_type new_size);
+
+	// Calls f(index, element) for each element of v whose key equals the given key.
+	template <class F>
+	void find(const StableVector& v, const key_type& key, F&& f) const;
+
+	bool may_contain(size_type chunk, const key_type& key) const { return test(chunk, mix(m_hash(key))); }
+
+	size_type indexed_size() const noexcept { return m_indexed; }
+	size_type memory_usage() const noexcept { return m_filters.size() * sizeof(uint64_t); }
+
+private:
+	static constexpr std::size_t block_words = 8;
+	static constexpr std::size_t block_bits = block_words * 64;
+	static constexpr std::size_t hashes = 6;
+	static constexpr std::size_t blocks_per_chunk = (chunk_size * BitsPerElement + block_bits - 1) / block_bits;
+	static constexpr std::size_t words_per_chunk = blocks_per_chunk * block_words;
+
+	// std::hash is the identity for integers on most implementations: spread the bits (murmur3 finalizer)
+	static uint64_t mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// the block comes from the high 32 bits and the first probe from the low ones; the stride of the
+	// probes is remixed so that it does not depend on the bits which picked the block
+	static uint32_t stride(uint64_t h) { return static_cast<uint32_t>(mix(h ^ 0x9e3779b97f4a7c15ULL) >> 32) | 1; }
+
+	static const uint64_t* block(const uint64_t* filter, uint64_t h) { return filter + ((h >> 32) % blocks_per_chunk) * block_words; }
+	static uint64_t* block(uint64_t* filter, uint64_t h) { return filter + ((h >> 32) % blocks_per_chunk) * block_words; }
+
+	void insert(size_type chunk, uint64_t h);
+	bool test(size_type chunk, uint64_t h) const;
+
+	KeyExtractor m_key;
+	Hash m_hash;
+	std::vector<uint64_t> m_filters;
+	size_type m_indexed = 0;
+};
+
+
+
+
+
+
+template <class StableVector, class KeyExtractor, std::size_t BitsPerElement, class Hash>
+void chunk_bloom_index<StableVector, KeyExtractor, BitsPerElement, Hash>::insert(size_type chunk, uint64_t h)
+{
+	uint64_t* b = block(&m_filters[chunk * words_per_chunk], h);
+
+	// double hashing within the block
+	const uint32_t h1 = static_cast<uint32_t>(h);
+	const uint32_t h2 = stride(h);
+	for (uint32_t i = 0; i < hashes; ++i)
+	{
+		const uint32_t bit = (h1 + i * h2) % block_bits;
+		b[bit / 64] |= uint64_t(1) << (bit % 64);
+	}
+}
+
+template <class StableVector, class KeyExtractor, std::size_t BitsPerElement, class Hash>
+bool chunk_bloom_index<StableVector, KeyExtractor, BitsPerElement, Hash>::test(size_type chunk, uint64_t h) const
+{
+	const uint64_t* b = block(&m_filters[chunk * words_per_chunk], h);
+
+	const uint32_t h1 = static_cast<uint32_t>(h);
+	const uint32_t h2 = stride(h);
+	for (uint32_t i = 0; i < hashes; ++i)
+	{
+		const uint32_t bit = (h1 + i * h2) % block_bits;
+		if (!(b[bit / 64] & (uint64_t(1) << (bit % 64))))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template <class StableVector, class KeyExtractor, std::size_t BitsPerElement, class Hash>
+void chunk_bloom_index<StableVector, KeyExtractor, BitsPerElement, Hash>::update(const StableVector& v)
+{
+	const size_type size = v.size();
+	if (size < m_indexed)
+	{
+		truncate(size);
+	}
+	if (m_indexed == size)
+	{
+		return;
+	}
+
+	m_filters.resize((size + chunk_size - 1) / chunk_size * words_per_chunk);
+
+	while (m_indexed < size)
+	{
+		const size_type chunk = m_indexed / chunk_size;
+		const size_type end = std::min(size, (chunk + 1) * chunk_size);
+		const value_type* data = v.chunk_data(chunk);
+
+		for (size_type i = m_indexed; i < end; ++i)
+		{
+			insert(chunk, mix(m_hash(m_key(data[i - chunk * chunk_size]))));
+		}
+		m_indexed = end;
+	}
+}
+
+template <class StableVector, class KeyExtractor, std::size_t BitsPerElement, class Hash>
+void chunk_bloom_index<StableVector, KeyExtractor, BitsPerElement, Hash>::truncate(size_type new_size)
+{
+	if (new_size >= m_indexed)
+	{
+		return;
+	}
+
+	const size_type chunk = new_size / chunk_size;
+	m_filters.resize(chunk * words_per_chunk);
+	m_indexed = chunk * chunk_size;
+}
+
+template <class StableVector, class KeyExtractor, std::size_t BitsPerElement, class Hash>
+template <class F>
+void chunk_bloom_index<StableVector, KeyExtractor, BitsPerElement, Hash>::find(const StableVector& v, const key_type& key, F&& f) const
+{
+	const uint64_t h = mix(m_hash(key));
+	const size_type size = v.size();
+
+	for (size_type first = 0; first < size; first += chunk_size)
+	{
+		const size_type chunk = first / chunk_size;
+		const size_type end = std::min(size, first + chunk_size);
+
+		// chunks entirely indexed are skipped unless their filter matches; filters of a container which
+		// shrank since the last update() are not trusted
+		if (end <= m_indexed && m_indexed <= size && !test(chunk, h))
+		{
+			continue;
+		}
+
+		const value_type* data = v.chunk_data(chunk);
+		for (size_type i = first; i < end; ++i)
+		{
+			if (m_key(data[i - first]) == key)
+			{
+				f(i, data[i - first]);
+			}
+		}
+	}
+}
@@ -0,0 +1,475 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <boost/align/aligned_alloc.hpp>
+#include <boost/align/aligned_delete.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Ordered secondary index over a key of the elements. It is a B+tree holding 32-bit element indices
+// only: keys are read back from the container through the extractor, so an entry costs 4 bytes, and
+// leaves of 60 entries take 4 cache lines, to which they are aligned.
+//
+// Elements with equal keys are ordered by index. The index is maintained by calling update() after
+// appending elements, and only covers the elements present at the last update(). Removing elements
+// (clear(), rollback(), assign()) requires a call to truncate(), e.g. from the on_clear() and
+// on_rollback() hooks of the container's observer; update() also detects a container smaller than
+// the index.
+template <class StableVector,
+		  class KeyExtractor,
+		  class Compare = std::less<std::decay_t<std::result_of_t<KeyExtractor(const typename StableVector::value_type&)>>>>
+class ordered_index
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using key_type = std::decay_t<std::result_of_t<KeyExtractor(const value_type&)>>;
+	using size_type = std::size_t;
+
+private:
+	static constexpr std::size_t leaf_capacity = 60;
+	static constexpr std::size_t inner_capacity = 40;
+
+	struct alignas(64) leaf
+	{
+		// one extra slot to insert before splitting
+		uint32_t entries[leaf_capacity + 1];
+		uint32_t count = 0;
+		leaf* next = nullptr;
+	};
+
+	static_assert(sizeof(leaf) == 256, "a leaf takes 4 cache lines");
+
+	struct alignas(64) inner
+	{
+		// separators[i] is the first entry of the subtree children[i + 1]
+		uint32_t separators[inner_capacity + 1];
+		void* children[inner_capacity + 2];
+		uint32_t count = 0;
+	};
+
+public:
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = typename ordered_index::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type*;
+		using reference = const value_type&;
+
+		const_iterator() = default;
+
+		reference operator*() const { return (*m_container)[index()]; }
+		pointer operator->() const { return &**this; }
+
+		// index of the element in the container
+		size_type index() const { return m_leaf->entries[m_pos]; }
+
+		const_iterator& operator++() { ++m_pos; normalize(); return *this; }
+		const_iterator operator++(int) { const_iterator it = *this; ++*this; return it; }
+
+		bool operator==(const const_iterator& it) const { return m_leaf == it.m_leaf && m_pos == it.m_pos; }
+		bool operator!=(const const_iterator& it) const { return !(*this == it); }
+
+	private:
+		friend class ordered_index;
+
+		const_iterator(const StableVector* c, const leaf* l, uint32_t pos) :
+			m_container(c),
+			m_leaf(l),
+			m_pos(pos)
+		{
+			normalize();
+		}
+
+		void normalize()
+		{
+			if (m_leaf && m_pos == m_leaf->count)
+			{
+				m_leaf = m_leaf->next;
+				m_pos = 0;
+			}
+		}
+
+		const StableVector* m_container = nullptr;
+		const leaf* m_leaf = nullptr;
+		uint32_t m_pos = 0;
+	};
+
+	struct range
+	{
+		const_iterator begin() const { return first; }
+		const_iterator end() const { return last; }
+
+		const_iterator first;
+		const_iterator last;
+	};
+
+	explicit ordered_index(KeyExtractor key = KeyExtractor(), Compare compare = Compare()) :
+		m_key(std::move(key)),
+		m_compare(std::move(compare))
+	{
+	}
+
+	// Indexes the elements appended to v since the last call.
+	void update(const StableVector& v);
+
+	// Forgets the elements from new_size on. As entries are ordered by key, the remaining ones are
+	// packed in the first leaves and the inner nodes are rebuilt over them, without allocating.
+	void truncate(size_type new_size);
+
+	const_iterator begin(const StableVector& v) const { return {&v, m_first, 0}; }
+	const_iterator end(const StableVector& v) const { return {&v, nullptr, 0}; }
+
+	// First element whose key is not less than / greater than the given key.
+	const_iterator lower_bound(const StableVector& v, const key_type& key) const;
+	const_iterator upper_bound(const StableVector& v, const key_type& key) const;
+
+	// Elements whose key is in [low, high).
+	range between(const StableVector& v, const key_type& low, const key_type& high) const { return {lower_bound(v, low), lower_bound(v, high)}; }
+	range equal_range(const StableVector& v, const key_type& key) const { return {lower_bound(v, key), upper_bound(v, key)}; }
+
+	size_type size() const noexcept { return m_indexed; }
+	size_type height() const noexcept { return m_height; }
+
+private:
+	struct split
+	{
+		uint32_t separator;
+		void* right;
+	};
+
+	template <bool Upper>
+	const_iterator bound(const StableVector& v, const key_type& key) const;
+
+	// number of entries positioned before key: those less than it, or not greater when Upper is set
+	template <bool Upper>
+	uint32_t position(const StableVector& v, const uint32_t* entries, uint32_t count, const key_type& key) const;
+
+	bool insert(const StableVector& v, void* node, size_type level, uint32_t index, const key_type& key, split& s);
+
+	// nodes are over-aligned, which operator new does not honour before C++17
+	template <class Node>
+	using node_ptr = std::unique_ptr<Node, boost::alignment::aligned_delete>;
+
+	template <class Node>
+	static node_ptr<Node> make_node();
+
+	leaf* new_leaf();
+	inner* new_inner();
+
+	// entries[0] of the first leaf below node
+	static uint32_t first_entry(const void* node, size_type height);
+
+	KeyExtractor m_key;
+	Compare m_compare;
+
+	void* m_root = nullptr;
+	leaf* m_first = nullptr;
+	size_type m_height = 0;
+	size_type m_indexed = 0;
+
+	std::vector<node_ptr<leaf>> m_leaves;
+	std::vector<node_ptr<inner>> m_inners;
+};
+
+
+
+
+
+
+template <class StableVector, class KeyExtractor, class Compare>
+template <class Node>
+typename ordered_index<StableVector, KeyExtractor, Compare>::template node_ptr<Node> ordered_index<StableVector, KeyExtractor, Compare>::make_node()
+{
+	void* p = boost::alignment::aligned_alloc(alignof(Node), sizeof(Node));
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return node_ptr<Node>(new (p) Node());
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+typename ordered_index<StableVector, KeyExtractor, Compare>::leaf* ordered_index<StableVector, KeyExtractor, Compare>::new_leaf()
+{
+	m_leaves.push_back(make_node<leaf>());
+	return m_leaves.back().get();
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+typename ordered_index<StableVector, KeyExtractor, Compare>::inner* ordered_index<StableVector, KeyExtractor, Compare>::new_inner()
+{
+	m_inners.push_back(make_node<inner>());
+	return m_inners.back().get();
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+uint32_t ordered_index<StableVector, KeyExtractor, Compare>::first_entry(const void* node, size_type height)
+{
+	for (; height > 0; --height)
+	{
+		node = static_cast<const inner*>(node)->children[0];
+	}
+	return static_cast<const leaf*>(node)->entries[0];
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+template <bool Upper>
+uint32_t ordered_index<StableVector, KeyExtractor, Compare>::position(const StableVector& v, const uint32_t* entries, uint32_t count, const key_type& key) const
+{
+	uint32_t first = 0;
+	while (count > 0)
+	{
+		const uint32_t half = count / 2;
+		const auto& k = m_key(v[entries[first + half]]);
+
+		if (Upper ? !m_compare(key, k) : m_compare(k, key))
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+	return first;
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+bool ordered_index<StableVector, KeyExtractor, Compare>::insert(const StableVector& v, void* node, size_type level, uint32_t index, const key_type& key, split& s)
+{
+	if (level == 0)
+	{
+		leaf& l = *static_cast<leaf*>(node);
+		const uint32_t pos = position<true>(v, l.entries, l.count, key);
+		std::copy_backward(l.entries + pos, l.entries + l.count, l.entries + l.count + 1);
+		l.entries[pos] = index;
+
+		if (++l.count <= leaf_capacity)
+		{
+			return false;
+		}
+
+		// appends with increasing keys leave full leaves behind them instead of half-empty ones
+		const uint32_t keep = pos == leaf_capacity ? static_cast<uint32_t>(leaf_capacity) : l.count / 2;
+
+		leaf* right = new_leaf();
+		right->count = l.count - keep;
+		std::copy(l.entries + keep, l.entries + l.count, right->entries);
+		right->next = l.next;
+		l.count = keep;
+		l.next = right;
+
+		s = {right->entries[0], right};
+		return true;
+	}
+
+	inner& n = *static_cast<inner*>(node);
+	const uint32_t child = position<true>(v, n.separators, n.count, key);
+
+	split child_split;
+	if (!insert(v, n.children[child], level - 1, index, key, child_split))
+	{
+		return false;
+	}
+
+	std::copy_backward(n.separators + child, n.separators + n.count, n.separators + n.count + 1);
+	std::copy_backward(n.children + child + 1, n.children + n.count + 1, n.children + n.count + 2);
+	n.separators[child] = child_split.separator;
+	n.children[child + 1] = child_split.right;
+
+	if (++n.count <= inner_capacity)
+	{
+		return false;
+	}
+
+	// the middle separator moves up to the parent
+	const uint32_t middle = child == inner_capacity ? static_cast<uint32_t>(inner_capacity) : n.count / 2;
+
+	inner* right = new_inner();
+	right->count = n.count - middle - 1;
+	std::copy(n.separators + middle + 1, n.separators + n.count, right->separators);
+	std::copy(n.children + middle + 1, n.children + n.count + 1, right->children);
+	n.count = middle;
+
+	s = {n.separators[middle], right};
+	return true;
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+void ordered_index<StableVector, KeyExtractor, Compare>::update(const StableVector& v)
+{
+	const size_type size = v.size();
+	if (size > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::length_error("ordered_index: more than 2^32 elements");
+	}
+
+	if (size < m_indexed)
+	{
+		truncate(size);
+	}
+
+	if (!m_root && m_indexed < size)
+	{
+		m_first = new_leaf();
+		m_root = m_first;
+	}
+
+	for (; m_indexed < size; ++m_indexed)
+	{
+		const auto index = static_cast<uint32_t>(m_indexed);
+
+		split s;
+		if (insert(v, m_root, m_height, index, m_key(v[index]), s))
+		{
+			inner* root = new_inner();
+			root->count = 1;
+			root->separators[0] = s.separator;
+			root->children[0] = m_root;
+			root->children[1] = s.right;
+
+			m_root = root;
+			++m_height;
+		}
+	}
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+void ordered_index<StableVector, KeyExtractor, Compare>::truncate(size_type new_size)
+{
+	if (new_size >= m_indexed)
+	{
+		return;
+	}
+
+	m_indexed = new_size;
+	if (new_size == 0)
+	{
+		m_root = nullptr;
+		m_first = nullptr;
+		m_height = 0;
+		m_leaves.clear();
+		m_inners.clear();
+		return;
+	}
+
+	// the entries kept are packed in order: writes never overtake reads, and the last leaf written is
+	// not empty, as new_size entries are kept
+	leaf* last = m_first;
+	uint32_t last_count = 0;
+	size_type leaves = 1;
+	for (leaf* l = m_first; l; l = l->next)
+	{
+		for (uint32_t i = 0; i < l->count; ++i)
+		{
+			if (l->entries[i] < new_size)
+			{
+				if (last_count == leaf_capacity)
+				{
+					last = last->next;
+					last_count = 0;
+					++leaves;
+				}
+				last->entries[last_count++] = l->entries[i];
+			}
+		}
+	}
+
+	bool packed = true;
+	for (leaf* l = m_first; l; l = l->next)
+	{
+		l->count = packed ? (l == last ? last_count : static_cast<uint32_t>(leaf_capacity)) : 0;
+		packed = packed && l != last;
+	}
+	last->next = nullptr;
+	m_leaves.erase(std::remove_if(m_leaves.begin(), m_leaves.end(), [](const node_ptr<leaf>& l) { return l->count == 0; }), m_leaves.end());
+
+	// full inner nodes over the packed leaves, level by level: no level needs more nodes than before,
+	// so the existing ones are reused in order
+	leaf* next_leaf = m_first;
+	size_type below = 0;
+	size_type nodes = leaves;
+	size_type used = 0;
+	m_height = 0;
+	while (nodes > 1)
+	{
+		const size_type level = used;
+		for (size_type c = 0; c < nodes; ++used)
+		{
+			inner& n = *m_inners[used];
+			uint32_t k = 0;
+			for (; c < nodes && k <= inner_capacity; ++c, ++k)
+			{
+				void* child = next_leaf;
+				if (m_height == 0)
+				{
+					next_leaf = next_leaf->next;
+				}
+				else
+				{
+					child = m_inners[below + c].get();
+				}
+
+				n.children[k] = child;
+				if (k > 0)
+				{
+					n.separators[k - 1] = first_entry(child, m_height);
+				}
+			}
+			n.count = k - 1;
+		}
+
+		below = level;
+		nodes = used - level;
+		++m_height;
+	}
+
+	m_root = m_height > 0 ? static_cast<void*>(m_inners[used - 1].get()) : m_first;
+	m_inners.erase(m_inners.begin() + static_cast<std::ptrdiff_t>(used), m_inners.end());
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+template <bool Upper>
+typename ordered_index<StableVector, KeyExtractor, Compare>::const_iterator
+ordered_index<StableVector, KeyExtractor, Compare>::bound(const StableVector& v, const key_type& key) const
+{
+	if (!m_root)
+	{
+		return end(v);
+	}
+
+	const void* node = m_root;
+	for (size_type level = m_height; level > 0; --level)
+	{
+		const inner& n = *static_cast<const inner*>(node);
+		node = n.children[position<Upper>(v, n.separators, n.count, key)];
+	}
+
+	const leaf& l = *static_cast<const leaf*>(node);
+	return {&v, &l, position<Upper>(v, l.entries, l.count, key)};
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+typename ordered_index<StableVector, KeyExtractor, Compare>::const_iterator
+ordered_index<StableVector, KeyExtractor, Compare>::lower_bound(const StableVector& v, const key_type& key) const
+{
+	return bound<false>(v, key);
+}
+
+template <class StableVector, class KeyExtractor, class Compare>
+typename ordered_index<StableVector, KeyExtractor, Compare>::const_iterator
+ordered_index<StableVector, KeyExtractor, Compare>::upper_bound(const StableVector& v, const key_type& key) const
+{
+	return bound<true>(v, key);
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "stable_vector.h"
+#include "stable_vector_parallel.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C (Castagnoli), as computed by the SSE4.2 crc32 instruction. The instruction is used when the
+// CPU supports it, a table-driven implementation otherwise.
+
+namespace crc32c_detail {
+
+struct table
+{
+	table()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78u : 0u);
+			}
+			entries[i] = crc;
+		}
+	}
+
+	uint32_t entries[256];
+};
+
+// crc is neither pre- nor post-inverted
+inline uint32_t software(uint32_t crc, const void* data, std::size_t size)
+{
+	static const table t;
+
+	const auto* p = static_cast<const unsigned char*>(data);
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		crc = t.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+inline uint32_t hardware(uint32_t crc, const void* data, std::size_t size)
+{
+	const auto* p = static_cast<const unsigned char*>(data);
+
+	uint64_t crc64 = crc;
+	for (; size >= 8; size -= 8, p += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+
+	crc = static_cast<uint32_t>(crc64);
+	for (; size > 0; --size, ++p)
+	{
+		crc = _mm_crc32_u8(crc, *p);
+	}
+	return crc;
+}
+
+inline bool has_hardware()
+{
+	static const bool supported = __builtin_cpu_supports("sse4.2");
+	return supported;
+}
+
+#else
+
+inline uint32_t hardware(uint32_t crc, const void* data, std::size_t size) { return software(crc, data, size); }
+inline bool has_hardware() { return false; }
+
+#endif
+
+}
+
+// CRC32C of size bytes; crc is the checksum of the preceding bytes, to compute it incrementally.
+inline uint32_t crc32c(const void* data, std::size_t size, uint32_t crc = 0)
+{
+	crc = ~crc;
+	crc = crc32c_detail::has_hardware() ? crc32c_detail::hardware(crc, data, size) : crc32c_detail::software(crc, data, size);
+	return ~crc;
+}
+
+// CRC32C of every sealed (i.e. full) chunk of a container of trivially copyable elements. Sealed chunks
+// never change, so their checksum is computed once, by calling update() after appending elements.
+// Checksums can also be loaded along with the data they cover, and checked against it.
+template <class StableVector>
+class chunk_checksums
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using size_type = std::size_t;
+
+	static_assert(std::is_trivially_copyable<value_type>::value, "checksums are computed over the bytes of the elements");
+
+	static constexpr std::size_t chunk_size = StableVector::chunk_size;
+
+	chunk_checksums() = default;
+	explicit chunk_checksums(std::vector<uint32_t> checksums) : m_checksums(std::move(checksums)) {}
+
+	// Checksum of the chunks sealed since the last call.
+	void update(const StableVector& v);
+
+	size_type sealed_chunks() const noexcept { return m_checksums.size(); }
+	uint32_t checksum(size_type c) const { return m_checksums[c]; }
+	const std::vector<uint32_t>& checksums() const noexcept { return m_checksums; }
+
+	// Checksum of the elements of chunk c, full or not.
+	static uint32_t compute(const StableVector& v, size_type c);
+
+	bool verify_chunk(const StableVector& v, size_type c) const;
+
+	// Chunks not matching their checksum, the chunks being verified in parallel.
+	std::vector<size_type> verify(const StableVector& v, unsigned threads = 0) const;
+
+private:
+	std::vector<uint32_t> m_checksums;
+};
+
+
+
+
+
+
+template <class StableVector>
+constexpr const std::size_t chunk_checksums<StableVector>::chunk_size;
+
+template <class StableVector>
+uint32_t chunk_checksums<StableVector>::compute(const StableVector& v, size_type c)
+{
+	return crc32c(v.chunk_data(c), v.chunk_length(c) * sizeof(value_type));
+}
+
+template <class StableVector>
+void chunk_checksums<StableVector>::update(const StableVector& v)
+{
+	const size_type sealed = v.size() / chunk_size;
+	for (size_type c = m_checksums.size(); c < sealed; ++c)
+	{
+		m_checksums.push_back(compute(v, c));
+	}
+}
+
+template <class StableVector>
+bool chunk_checksums<StableVector>::verify_chunk(const StableVector& v, size_type c) const
+{
+	return c < m_checksums.size() && v.chunk_length(c) == chunk_size && compute(v, c) == m_checksums[c];
+}
+
+template <class StableVector>
+std::vector<typename chunk_checksums<StableVector>::size_type> chunk_checksums<StableVector>::verify(const StableVector& v, unsigned threads) const
+{
+	const size_type chunks = m_checksums.size();
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	std::vector<std::vector<size_type>> failures(n);
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		for (size_type c = range.first; c < range.second; ++c)
+		{
+			if (!verify_chunk(v, c))
+			{
+				failures[t].push_back(c);
+			}
+		}
+	});
+
+	std::vector<size_type> corrupted;
+	for (const auto& f : failures)
+	{
+		corrupted.insert(corrupted.end(), f.begin(), f.end());
+	}
+	return corrupted;
+}
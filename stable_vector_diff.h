@@ -0,0 +1,163 @@
+#pragma once
+
+#include "stable_vector.h"
+#include "stable_vector_checksum.h"
+#include "stable_vector_parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Indices [first, last) of a container.
+struct index_range
+{
+	std::size_t first;
+	std::size_t last;
+
+	bool operator==(const index_range& r) const { return first == r.first && last == r.last; }
+	bool operator!=(const index_range& r) const { return !(*this == r); }
+};
+
+// Types whose equality is the equality of their bytes, compared with memcmp by diff(). Floating-point
+// types are not (0.0 == -0.0, NaN != NaN); specialize it for structs without padding.
+template <class T>
+struct is_trivially_comparable :
+	std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value>
+{};
+
+namespace diff_detail {
+
+template <class T>
+bool same_elements(const T* a, const T* b, std::size_t n, std::true_type /* memcmp */)
+{
+	return std::memcmp(a, b, n * sizeof(T)) == 0;
+}
+
+template <class T>
+bool same_elements(const T* a, const T* b, std::size_t n, std::false_type /* memcmp */)
+{
+	return std::equal(a, a + n, b);
+}
+
+template <class T>
+bool same_element(const T& a, const T& b, std::true_type /* memcmp */)
+{
+	return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+template <class T>
+bool same_element(const T& a, const T& b, std::false_type /* memcmp */)
+{
+	return a == b;
+}
+
+// Appends [first, last) to ranges, merging it with the last range if they are adjacent.
+inline void append(std::vector<index_range>& ranges, std::size_t first, std::size_t last)
+{
+	if (!ranges.empty() && ranges.back().last == first)
+	{
+		ranges.back().last = last;
+	}
+	else
+	{
+		ranges.push_back({first, last});
+	}
+}
+
+// Ranges of differing elements of a and b, over the elements they both have. Chunks for which
+// known_different(c) is true go straight to the element by element comparison.
+template <class StableVector, class KnownDifferent>
+std::vector<index_range> diff(const StableVector& a, const StableVector& b, KnownDifferent&& known_different, unsigned threads)
+{
+	using value_type = typename StableVector::value_type;
+	using memcmp_type = is_trivially_comparable<value_type>;
+	constexpr std::size_t N = StableVector::chunk_size;
+
+	const std::size_t size = std::min(a.size(), b.size());
+	const std::size_t chunks = (size + N - 1) / N;
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	std::vector<std::vector<index_range>> ranges(n);
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			const std::size_t length = std::min(N, size - c * N);
+			const value_type* x = a.chunk_data(c);
+			const value_type* y = b.chunk_data(c);
+
+			if (!known_different(c) && same_elements(x, y, length, memcmp_type()))
+			{
+				continue;
+			}
+
+			// runs of differing elements, each appended at once
+			auto same = [](const value_type& p, const value_type& q) { return same_element(p, q, memcmp_type()); };
+			std::size_t i = 0;
+			while (true)
+			{
+				i = static_cast<std::size_t>(std::mismatch(x + i, x + length, y + i, same).first - x);
+				if (i == length)
+				{
+					break;
+				}
+
+				const std::size_t first = i;
+				while (i < length && !same(x[i], y[i]))
+				{
+					++i;
+				}
+				append(ranges[t], c * N + first, c * N + i);
+			}
+		}
+	});
+
+	std::vector<index_range> result;
+	for (const auto& thread_ranges : ranges)
+	{
+		for (const auto& r : thread_ranges)
+		{
+			append(result, r.first, r.last);
+		}
+	}
+	return result;
+}
+
+}
+
+// Sorted, non-adjacent ranges of indices whose elements differ between a and b; when the sizes
+// differ, the elements only one of them has are part of the last range. Chunks are compared in
+// parallel, with memcmp first for trivially comparable elements, then element by element to locate
+// the differences.
+template <class StableVector>
+std::vector<index_range> diff(const StableVector& a, const StableVector& b, unsigned threads = 0)
+{
+	auto ranges = diff_detail::diff(a, b, [](std::size_t) { return false; }, threads);
+	if (a.size() != b.size())
+	{
+		diff_detail::append(ranges, std::min(a.size(), b.size()), std::max(a.size(), b.size()));
+	}
+	return ranges;
+}
+
+// Same as above, with the checksums of sealed chunks: chunks whose CRC32C differ are known to differ,
+// and are searched for their differences without comparing them as a whole first. Chunks with equal
+// checksums are still compared, a CRC collision being possible, so the result is the same as without
+// checksums.
+template <class StableVector>
+std::vector<index_range> diff(const StableVector& a, const chunk_checksums<StableVector>& checksums_a,
+							  const StableVector& b, const chunk_checksums<StableVector>& checksums_b,
+							  unsigned threads = 0)
+{
+	const std::size_t sealed = std::min(checksums_a.sealed_chunks(), checksums_b.sealed_chunks());
+	auto different_checksum = [&](std::size_t c) { return c < sealed && checksums_a.checksum(c) != checksums_b.checksum(c); };
+
+	auto ranges = diff_detail::diff(a, b, different_checksum, threads);
+	if (a.size() != b.size())
+	{
+		diff_detail::append(ranges, std::min(a.size(), b.size()), std::max(a.size(), b.size()));
+	}
+	return ranges;
+}
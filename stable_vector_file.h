@@ -0,0 +1,418 @@
+#pragma once
+
+#include "stable_vector.h"
+#include "stable_vector_checksum.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// File format for containers of trivially copyable elements, read back by index range: only the
+// chunks covering the range are read or mapped.
+//
+//   header   magic, element size, chunk size
+//   chunks   the elements of each chunk, at 64-byte aligned offsets
+//   index    offset, element count and CRC32C of each chunk
+//   trailer  chunk count, element count, offset of the index, magic
+//
+// Integers and elements are stored in the native byte order.
+
+namespace file_detail {
+
+constexpr char magic[8] = {'S', 'T', 'V', 'E', 'C', 'F', '0', '1'};
+constexpr std::size_t chunk_alignment = 64;
+
+struct header
+{
+	char magic[8];
+	uint64_t element_size;
+	uint64_t chunk_size;
+};
+
+struct index_entry
+{
+	uint64_t offset;
+	uint64_t count;
+	uint32_t crc;
+	uint32_t reserved;
+};
+
+struct trailer
+{
+	uint64_t chunk_count;
+	uint64_t size;
+	uint64_t index_offset;
+	char magic[8];
+};
+
+}
+
+// Elements [first, last) of a file, read into memory. Indices are those of the saved container.
+template <class T, std::size_t ChunkSize>
+class loaded_range
+{
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+
+	size_type first() const noexcept { return m_first; }
+	size_type last() const noexcept { return m_last; }
+	size_type size() const noexcept { return m_last - m_first; }
+
+	const T& operator[](size_type i) const { return m_chunks[i - m_base]; }
+
+	// The chunks covering the range, element 0 being element base() of the saved container.
+	const stable_vector<T, ChunkSize>& chunks() const noexcept { return m_chunks; }
+	size_type base() const noexcept { return m_base; }
+
+private:
+	template <class, std::size_t>
+	friend class stable_vector_file;
+
+	stable_vector<T, ChunkSize> m_chunks;
+	size_type m_base = 0;
+	size_type m_first = 0;
+	size_type m_last = 0;
+};
+
+// Elements [first, last) of a file, mapped read-only in memory: pages are only read when accessed.
+template <class T, std::size_t ChunkSize>
+class mapped_range
+{
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+
+	mapped_range() = default;
+	~mapped_range();
+
+	mapped_range(const mapped_range&) = delete;
+	mapped_range& operator=(const mapped_range&) = delete;
+
+	mapped_range(mapped_range&& other) noexcept { swap(other); }
+	mapped_range& operator=(mapped_range&& other) noexcept { mapped_range(std::move(other)).swap(*this); return *this; }
+
+	void swap(mapped_range& other) noexcept;
+
+	size_type first() const noexcept { return m_first; }
+	size_type last() const noexcept { return m_last; }
+	size_type size() const noexcept { return m_last - m_first; }
+
+	const T& operator[](size_type i) const { return m_data[i / ChunkSize - m_base_chunk][i % ChunkSize]; }
+
+private:
+	template <class, std::size_t>
+	friend class stable_vector_file;
+
+	void* m_mapping = nullptr;
+	size_type m_length = 0;
+	std::vector<const T*> m_data;
+	size_type m_base_chunk = 0;
+	size_type m_first = 0;
+	size_type m_last = 0;
+};
+
+template <class T, std::size_t ChunkSize>
+class stable_vector_file
+{
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+
+	static_assert(std::is_trivially_copyable<T>::value, "elements are written as bytes");
+
+	static constexpr std::size_t chunk_size = ChunkSize;
+
+	// Writes the elements of v to path, which is overwritten.
+	template <class StableVector>
+	static void save(const StableVector& v, const std::string& path);
+
+	// Opens a file written by save() from a container of the same element and chunk size.
+	explicit stable_vector_file(const std::string& path);
+	~stable_vector_file();
+
+	stable_vector_file(const stable_vector_file&) = delete;
+	stable_vector_file& operator=(const stable_vector_file&) = delete;
+
+	size_type size() const noexcept { return m_size; }
+	size_type chunk_count() const noexcept { return m_index.size(); }
+
+	// Reads the chunks covering [first, last), checking their CRC32C if verify is set.
+	loaded_range<T, ChunkSize> read_range(size_type first, size_type last, bool verify = true) const;
+
+	// Maps the chunks covering [first, last). Checking their CRC32C reads them all.
+	mapped_range<T, ChunkSize> map_range(size_type first, size_type last, bool verify = false) const;
+
+private:
+	std::pair<size_type, size_type> chunks_covering(size_type first, size_type last) const;
+	void check(const T* data, size_type c) const;
+	void read(void* data, size_type bytes, size_type offset) const;
+
+	[[noreturn]] static void fail(const std::string& what) { throw std::runtime_error("stable_vector_file: " + what); }
+
+	std::string m_path;
+	int m_fd = -1;
+	size_type m_size = 0;
+	std::vector<file_detail::index_entry> m_index;
+};
+
+
+
+
+
+
+template <class T, std::size_t ChunkSize>
+constexpr const std::size_t stable_vector_file<T, ChunkSize>::chunk_size;
+
+template <class T, std::size_t ChunkSize>
+template <class StableVector>
+void stable_vector_file<T, ChunkSize>::save(const StableVector& v, const std::string& path)
+{
+	static_assert(StableVector::chunk_size == ChunkSize, "the file has the chunk size of the container");
+
+	std::ofstream out;
+	out.exceptions(std::ios::failbit | std::ios::badbit);
+	out.open(path, std::ios::binary | std::ios::trunc);
+
+	file_detail::header h;
+	std::memcpy(h.magic, file_detail::magic, sizeof(h.magic));
+	h.element_size = sizeof(T);
+	h.chunk_size = ChunkSize;
+	out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+	const char padding[file_detail::chunk_alignment] = {};
+	uint64_t offset = sizeof(h);
+
+	std::vector<file_detail::index_entry> index;
+	for (size_type c = 0; c * ChunkSize < v.size(); ++c)
+	{
+		const uint64_t aligned = (offset + file_detail::chunk_alignment - 1) / file_detail::chunk_alignment * file_detail::chunk_alignment;
+		out.write(padding, static_cast<std::streamsize>(aligned - offset));
+
+		const size_type bytes = v.chunk_length(c) * sizeof(T);
+		out.write(reinterpret_cast<const char*>(v.chunk_data(c)), static_cast<std::streamsize>(bytes));
+
+		index.push_back({aligned, v.chunk_length(c), crc32c(v.chunk_data(c), bytes), 0});
+		offset = aligned + bytes;
+	}
+
+	out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(file_detail::index_entry)));
+
+	file_detail::trailer t;
+	t.chunk_count = index.size();
+	t.size = v.size();
+	t.index_offset = offset;
+	std::memcpy(t.magic, file_detail::magic, sizeof(t.magic));
+	out.write(reinterpret_cast<const char*>(&t), sizeof(t));
+}
+
+template <class T, std::size_t ChunkSize>
+stable_vector_file<T, ChunkSize>::stable_vector_file(const std::string& path) :
+	m_path(path)
+{
+	m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0)
+	{
+		throw std::system_error(errno, std::generic_category(), "stable_vector_file: open " + path);
+	}
+
+	try
+	{
+		const off_t file_size = ::lseek(m_fd, 0, SEEK_END);
+		if (file_size < static_cast<off_t>(sizeof(file_detail::header) + sizeof(file_detail::trailer)))
+		{
+			fail(path + " is too small");
+		}
+
+		file_detail::header h;
+		read(&h, sizeof(h), 0);
+
+		file_detail::trailer t;
+		read(&t, sizeof(t), static_cast<size_type>(file_size) - sizeof(t));
+
+		if (std::memcmp(h.magic, file_detail::magic, sizeof(h.magic)) != 0 || std::memcmp(t.magic, file_detail::magic, sizeof(t.magic)) != 0)
+		{
+			fail(path + " is not a stable_vector file");
+		}
+		if (h.element_size != sizeof(T) || h.chunk_size != ChunkSize)
+		{
+			fail(path + " has a different element or chunk size");
+		}
+
+		// the index lies between the header and the trailer
+		const size_type index_end = static_cast<size_type>(file_size) - sizeof(t);
+		if (t.chunk_count != t.size / ChunkSize + (t.size % ChunkSize != 0) ||
+			t.index_offset < sizeof(h) || t.index_offset > index_end ||
+			(index_end - t.index_offset) % sizeof(file_detail::index_entry) != 0 ||
+			t.chunk_count != (index_end - t.index_offset) / sizeof(file_detail::index_entry))
+		{
+			fail(path + ": inconsistent trailer");
+		}
+
+		m_size = t.size;
+		m_index.resize(t.chunk_count);
+		read(m_index.data(), m_index.size() * sizeof(file_detail::index_entry), t.index_offset);
+
+		// indexing relies on every chunk but the last one being full, and chunks lie between the
+		// header and the index
+		for (size_type c = 0; c < m_index.size(); ++c)
+		{
+			const file_detail::index_entry& e = m_index[c];
+			if (e.count != std::min<size_type>(ChunkSize, m_size - c * ChunkSize) ||
+				e.offset < sizeof(h) || e.offset % file_detail::chunk_alignment != 0 ||
+				e.offset > t.index_offset || e.count * sizeof(T) > t.index_offset - e.offset)
+			{
+				fail(path + ": inconsistent chunk index");
+			}
+		}
+	}
+	catch (...)
+	{
+		::close(m_fd);
+		throw;
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+stable_vector_file<T, ChunkSize>::~stable_vector_file()
+{
+	::close(m_fd);
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_vector_file<T, ChunkSize>::read(void* data, size_type bytes, size_type offset) const
+{
+	auto* p = static_cast<char*>(data);
+	while (bytes > 0)
+	{
+		const ssize_t n = ::pread(m_fd, p, bytes, static_cast<off_t>(offset));
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n < 0)
+		{
+			throw std::system_error(errno, std::generic_category(), "stable_vector_file: read " + m_path);
+		}
+		if (n == 0)
+		{
+			fail(m_path + " is truncated");
+		}
+
+		p += n;
+		bytes -= static_cast<size_type>(n);
+		offset += static_cast<size_type>(n);
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+std::pair<std::size_t, std::size_t> stable_vector_file<T, ChunkSize>::chunks_covering(size_type first, size_type last) const
+{
+	if (first > last || last > m_size)
+	{
+		throw std::out_of_range("stable_vector_file: range out of the file");
+	}
+	return {first / ChunkSize, (last + ChunkSize - 1) / ChunkSize};
+}
+
+template <class T, std::size_t ChunkSize>
+void stable_vector_file<T, ChunkSize>::check(const T* data, size_type c) const
+{
+	if (crc32c(data, m_index[c].count * sizeof(T)) != m_index[c].crc)
+	{
+		fail(m_path + ": checksum mismatch in chunk " + std::to_string(c));
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+loaded_range<T, ChunkSize> stable_vector_file<T, ChunkSize>::read_range(size_type first, size_type last, bool verify) const
+{
+	const auto chunks = chunks_covering(first, last);
+
+	loaded_range<T, ChunkSize> r;
+	r.m_base = chunks.first * ChunkSize;
+	r.m_first = first;
+	r.m_last = last;
+
+	const size_type count = std::min(m_size, chunks.second * ChunkSize) - r.m_base;
+	r.m_chunks.assign(count, T());
+
+	for (size_type c = chunks.first; c < chunks.second; ++c)
+	{
+		T* data = r.m_chunks.chunk_data(c - chunks.first);
+		read(data, m_index[c].count * sizeof(T), m_index[c].offset);
+		if (verify)
+		{
+			check(data, c);
+		}
+	}
+	return r;
+}
+
+template <class T, std::size_t ChunkSize>
+mapped_range<T, ChunkSize> stable_vector_file<T, ChunkSize>::map_range(size_type first, size_type last, bool verify) const
+{
+	const auto chunks = chunks_covering(first, last);
+
+	mapped_range<T, ChunkSize> r;
+	r.m_base_chunk = chunks.first;
+	r.m_first = first;
+	r.m_last = last;
+	if (first == last)
+	{
+		return r;
+	}
+
+	// mappings start on a page boundary
+	const auto page = static_cast<size_type>(sysconf(_SC_PAGESIZE));
+	const size_type begin = m_index[chunks.first].offset / page * page;
+	const size_type end = m_index[chunks.second - 1].offset + m_index[chunks.second - 1].count * sizeof(T);
+
+	void* mapping = ::mmap(nullptr, end - begin, PROT_READ, MAP_SHARED, m_fd, static_cast<off_t>(begin));
+	if (mapping == MAP_FAILED)
+	{
+		throw std::system_error(errno, std::generic_category(), "stable_vector_file: mmap " + m_path);
+	}
+	r.m_mapping = mapping;
+	r.m_length = end - begin;
+
+	for (size_type c = chunks.first; c < chunks.second; ++c)
+	{
+		const T* data = reinterpret_cast<const T*>(static_cast<const char*>(mapping) + (m_index[c].offset - begin));
+		if (verify)
+		{
+			check(data, c);
+		}
+		r.m_data.push_back(data);
+	}
+	return r;
+}
+
+template <class T, std::size_t ChunkSize>
+mapped_range<T, ChunkSize>::~mapped_range()
+{
+	if (m_mapping)
+	{
+		::munmap(m_mapping, m_length);
+	}
+}
+
+template <class T, std::size_t ChunkSize>
+void mapped_range<T, ChunkSize>::swap(mapped_range& other) noexcept
+{
+	std::swap(m_mapping, other.m_mapping);
+	std::swap(m_length, other.m_length);
+	std::swap(m_data, other.m_data);
+	std::swap(m_base_chunk, other.m_base_chunk);
+	std::swap(m_first, other.m_first);
+	std::swap(m_last, other.m_last);
+}
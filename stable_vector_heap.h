@@ -0,0 +1,178 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Indexed d-ary heap of element indices: the heap is a contiguous array of 32-bit indices, and the
+// position of each element in the heap is kept in a side chunked array, so that an element whose key
+// changed can be moved to its new place, or removed, in O(log n).
+//
+// top() is the element comparing smallest, i.e. with std::less the heap is a min-heap, the opposite
+// of std::priority_queue. Comparisons read the elements from the container, passed to every operation
+// that reorders the heap.
+template <class StableVector, class Compare = std::less<typename StableVector::value_type>, std::size_t Arity = 4>
+class indexed_heap
+{
+	static_assert(Arity >= 2, "a heap node has at least 2 children");
+
+public:
+	using value_type = typename StableVector::value_type;
+	using size_type = std::size_t;
+
+	static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+	explicit indexed_heap(Compare compare = Compare()) : m_compare(std::move(compare)) {}
+
+	bool empty() const noexcept { return m_heap.empty(); }
+	size_type size() const noexcept { return m_heap.size(); }
+
+	bool contains(uint32_t i) const noexcept { return i < m_positions.size() && m_positions[i] != npos; }
+
+	uint32_t top() const { return m_heap.front(); }
+
+	void push(const StableVector& v, uint32_t i);
+	uint32_t pop(const StableVector& v);
+
+	// To call after the key of element i, which is in the heap, changed.
+	void update(const StableVector& v, uint32_t i);
+
+	void erase(const StableVector& v, uint32_t i);
+
+private:
+	static constexpr std::size_t chunk_size = StableVector::chunk_size;
+
+	bool less(const StableVector& v, uint32_t a, uint32_t b) const { return m_compare(v[a], v[b]); }
+
+	void place(uint32_t pos, uint32_t i)
+	{
+		m_heap[pos] = i;
+		m_positions[i] = pos;
+	}
+
+	// moves element i, at pos, towards the root / the leaves
+	void sift_up(const StableVector& v, uint32_t pos, uint32_t i);
+	void sift_down(const StableVector& v, uint32_t pos, uint32_t i);
+
+	Compare m_compare;
+	std::vector<uint32_t> m_heap;
+	stable_vector<uint32_t, chunk_size> m_positions;
+};
+
+
+
+
+
+
+template <class StableVector, class Compare, std::size_t Arity>
+constexpr const uint32_t indexed_heap<StableVector, Compare, Arity>::npos;
+
+template <class StableVector, class Compare, std::size_t Arity>
+void indexed_heap<StableVector, Compare, Arity>::sift_up(const StableVector& v, uint32_t pos, uint32_t i)
+{
+	while (pos > 0)
+	{
+		const uint32_t parent = static_cast<uint32_t>((pos - 1) / Arity);
+		if (!less(v, i, m_heap[parent]))
+		{
+			break;
+		}
+		place(pos, m_heap[parent]);
+		pos = parent;
+	}
+	place(pos, i);
+}
+
+template <class StableVector, class Compare, std::size_t Arity>
+void indexed_heap<StableVector, Compare, Arity>::sift_down(const StableVector& v, uint32_t pos, uint32_t i)
+{
+	const size_type size = m_heap.size();
+	for (;;)
+	{
+		const size_type first = pos * Arity + 1;
+		if (first >= size)
+		{
+			break;
+		}
+
+		size_type best = first;
+		for (size_type c = first + 1; c < std::min(first + Arity, size); ++c)
+		{
+			if (less(v, m_heap[c], m_heap[best]))
+			{
+				best = c;
+			}
+		}
+
+		if (!less(v, m_heap[best], i))
+		{
+			break;
+		}
+		place(pos, m_heap[best]);
+		pos = static_cast<uint32_t>(best);
+	}
+	place(pos, i);
+}
+
+template <class StableVector, class Compare, std::size_t Arity>
+void indexed_heap<StableVector, Compare, Arity>::push(const StableVector& v, uint32_t i)
+{
+	assert(!contains(i));
+	if (m_heap.size() >= npos)
+	{
+		throw std::length_error("indexed_heap: more than 2^32 - 1 elements");
+	}
+
+	while (m_positions.size() <= i)
+	{
+		m_positions.push_back(npos);
+	}
+
+	m_heap.push_back(i);
+	sift_up(v, static_cast<uint32_t>(m_heap.size() - 1), i);
+}
+
+template <class StableVector, class Compare, std::size_t Arity>
+uint32_t indexed_heap<StableVector, Compare, Arity>::pop(const StableVector& v)
+{
+	const uint32_t i = m_heap.front();
+	erase(v, i);
+	return i;
+}
+
+template <class StableVector, class Compare, std::size_t Arity>
+void indexed_heap<StableVector, Compare, Arity>::update(const StableVector& v, uint32_t i)
+{
+	assert(contains(i));
+	const uint32_t pos = m_positions[i];
+	if (pos > 0 && less(v, i, m_heap[(pos - 1) / Arity]))
+	{
+		sift_up(v, pos, i);
+	}
+	else
+	{
+		sift_down(v, pos, i);
+	}
+}
+
+template <class StableVector, class Compare, std::size_t Arity>
+void indexed_heap<StableVector, Compare, Arity>::erase(const StableVector& v, uint32_t i)
+{
+	assert(contains(i));
+	const uint32_t pos = m_positions[i];
+	const uint32_t last = m_heap.back();
+
+	m_heap.pop_back();
+	m_positions[i] = npos;
+
+	// the last element takes the place of the erased one
+	if (last != i)
+	{
+		m_heap[pos] = last;
+		m_positions[last] = pos;
+		update(v, last);
+	}
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cstdint>
+#include <limits>
+
+// Intrusive doubly linked lists of element indices. As elements of a stable_vector never move, they
+// can be threaded into lists through the 32-bit indices of their neighbours, stored in an index_link
+// either inside the element (member_links) or in a parallel chunked array (side_links): inserting and
+// removing is O(1) and never allocates, and a link takes half the memory of two pointers.
+//
+// An index_list only holds its ends and size; the links are passed to every operation. An element
+// can belong to at most one list per link.
+
+namespace list_detail {
+
+// npos is a member of a class template, so that its definition can live in the header
+template <class = void>
+struct npos_base
+{
+	static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+};
+
+template <class Dummy>
+constexpr const uint32_t npos_base<Dummy>::npos;
+
+}
+
+struct index_link : list_detail::npos_base<>
+{
+	uint32_t prev = npos;
+	uint32_t next = npos;
+};
+
+// Links stored as a member of the elements.
+template <class StableVector, index_link StableVector::value_type::*Link>
+class member_links
+{
+public:
+	explicit member_links(StableVector& v) : m_container(v) {}
+
+	index_link& operator()(uint32_t i) { return m_container[i].*Link; }
+	const index_link& operator()(uint32_t i) const { return m_container[i].*Link; }
+
+private:
+	StableVector& m_container;
+};
+
+// Links stored beside the elements, link i belonging to element i. The array grows as elements are
+// linked.
+template <std::size_t ChunkSize = 1024>
+class side_links
+{
+public:
+	index_link& operator()(uint32_t i)
+	{
+		while (m_links.size() <= i)
+		{
+			m_links.emplace_back();
+		}
+		return m_links[i];
+	}
+
+	const index_link& operator()(uint32_t i) const { return m_links[i]; }
+
+private:
+	stable_vector<index_link, ChunkSize> m_links;
+};
+
+class index_list : public list_detail::npos_base<>
+{
+public:
+	using size_type = std::size_t;
+
+	bool empty() const noexcept { return m_size == 0; }
+	size_type size() const noexcept { return m_size; }
+
+	// npos if the list is empty
+	uint32_t front() const noexcept { return m_head; }
+	uint32_t back() const noexcept { return m_tail; }
+
+	template <class Links>
+	void push_back(Links& links, uint32_t i) { insert_before(links, npos, i); }
+
+	template <class Links>
+	void push_front(Links& links, uint32_t i) { insert_before(links, m_head, i); }
+
+	// Inserts i before pos, which is in the list, or at the end if pos is npos.
+	template <class Links>
+	void insert_before(Links& links, uint32_t pos, uint32_t i);
+
+	template <class Links>
+	void erase(Links& links, uint32_t i);
+
+	template <class Links>
+	uint32_t pop_front(Links& links)
+	{
+		const uint32_t i = m_head;
+		erase(links, i);
+		return i;
+	}
+
+	// Element after / before i, npos at the end.
+	template <class Links>
+	static uint32_t next(const Links& links, uint32_t i) { return links(i).next; }
+
+	template <class Links>
+	static uint32_t prev(const Links& links, uint32_t i) { return links(i).prev; }
+
+	// Calls f(index) for every element, from front to back. f can erase the element it is given.
+	template <class Links, class F>
+	void for_each(const Links& links, F&& f) const;
+
+private:
+	uint32_t m_head = npos;
+	uint32_t m_tail = npos;
+	size_type m_size = 0;
+};
+
+
+
+
+
+
+template <class Links>
+void index_list::insert_before(Links& links, uint32_t pos, uint32_t i)
+{
+	index_link& link = links(i);
+	link.next = pos;
+	link.prev = pos == npos ? m_tail : links(pos).prev;
+
+	if (link.prev == npos)
+	{
+		m_head = i;
+	}
+	else
+	{
+		links(link.prev).next = i;
+	}
+
+	if (pos == npos)
+	{
+		m_tail = i;
+	}
+	else
+	{
+		links(pos).prev = i;
+	}
+
+	++m_size;
+}
+
+template <class Links>
+void index_list::erase(Links& links, uint32_t i)
+{
+	assert(m_size > 0);
+	index_link& link = links(i);
+
+	if (link.prev == npos)
+	{
+		m_head = link.next;
+	}
+	else
+	{
+		links(link.prev).next = link.next;
+	}
+
+	if (link.next == npos)
+	{
+		m_tail = link.prev;
+	}
+	else
+	{
+		links(link.next).prev = link.prev;
+	}
+
+	link = index_link();
+	--m_size;
+}
+
+template <class Links, class F>
+void index_list::for_each(const Links& links, F&& f) const
+{
+	for (uint32_t i = m_head; i != npos;)
+	{
+		const uint32_t next = links(i).next;
+		f(i);
+		i = next;
+	}
+}
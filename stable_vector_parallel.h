@@ -0,0 +1,623 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Parallel algorithms over stable_vector. Work is split along chunk boundaries, and the split only
+// depends on the number of chunks and threads: with the same thread count, a given chunk is always
+// handled by the same worker.
+//
+// All algorithms take a thread count; 0 means std::thread::hardware_concurrency().
+
+namespace parallel_detail {
+
+inline unsigned thread_count(unsigned requested, std::size_t chunks)
+{
+	unsigned n = requested ? requested : std::thread::hardware_concurrency();
+	n = n ? n : 1;
+	return static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(n, chunks)));
+}
+
+// Runs f(t) for t in [0, n), each on its own thread, the calling thread running f(0). The first
+// exception thrown by f is rethrown once all the threads are done. If a thread cannot be started,
+// the ones already running are joined and the error is rethrown without running f(0).
+template <class F>
+void run(unsigned n, F&& f)
+{
+	std::exception_ptr error;
+	std::mutex error_mutex;
+
+	auto guarded = [&](unsigned t)
+	{
+		try
+		{
+			f(t);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error)
+			{
+				error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	workers.reserve(n - 1);
+
+	auto join = [&]()
+	{
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	};
+
+	// the threads already started must be joined if starting another one fails
+	try
+	{
+		for (unsigned t = 1; t < n; ++t)
+		{
+			workers.emplace_back(guarded, t);
+		}
+	}
+	catch (...)
+	{
+		join();
+		throw;
+	}
+
+	guarded(0);
+	join();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+// Chunks [first, second) handled by thread t out of n.
+inline std::pair<std::size_t, std::size_t> chunk_range(std::size_t chunks, unsigned n, unsigned t)
+{
+	return {chunks * t / n, chunks * (t + 1) / n};
+}
+
+template <class StableVector>
+std::size_t chunk_count(const StableVector& v)
+{
+	return (v.size() + StableVector::chunk_size - 1) / StableVector::chunk_size;
+}
+
+// Builds the chunks of a container from several threads.
+struct chunk_access
+{
+	template <class StableVector>
+	static void resize(StableVector& v, std::size_t size)
+	{
+		v.m_chunks.resize((size + StableVector::chunk_size - 1) / StableVector::chunk_size);
+		v.m_size = size;
+	}
+
+	// Allocates chunk c and constructs its elements from f(index). The chunk is only stored once
+	// filled, so that a failure leaves no partially constructed chunk behind.
+	template <class StableVector, class F>
+	static void construct(StableVector& v, std::size_t c, F& f)
+	{
+		constexpr std::size_t N = StableVector::chunk_size;
+
+		auto chunk = v.make_chunk();
+		const std::size_t last = std::min(v.m_size, (c + 1) * N);
+		for (std::size_t i = c * N; i < last; ++i)
+		{
+			chunk->emplace_back(f(i));
+		}
+		v.m_chunks[c] = std::move(chunk);
+	}
+};
+
+}
+
+// Permutation of the indices of v sorting its elements according to cmp. The sort is stable, so the
+// result does not depend on the number of threads. Elements are not moved.
+template <class StableVector, class Compare = std::less<typename StableVector::value_type>>
+stable_vector<uint32_t, StableVector::chunk_size> argsort(const StableVector& v, Compare cmp = Compare(), unsigned threads = 0)
+{
+	constexpr std::size_t N = StableVector::chunk_size;
+
+	const std::size_t size = v.size();
+	if (size > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::length_error("argsort: more than 2^32 elements");
+	}
+
+	const std::size_t chunks = parallel_detail::chunk_count(v);
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	auto less = [&v, &cmp](uint32_t a, uint32_t b) { return cmp(v[a], v[b]); };
+
+	// each thread sorts the indices of its chunks
+	std::vector<uint32_t> indices(size);
+	std::vector<std::size_t> bounds(n + 1, size);
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		const std::size_t first = range.first * N;
+		const std::size_t last = std::min(size, range.second * N);
+		bounds[t] = first;
+
+		for (std::size_t i = first; i < last; ++i)
+		{
+			indices[i] = static_cast<uint32_t>(i);
+		}
+		std::stable_sort(indices.begin() + static_cast<std::ptrdiff_t>(first), indices.begin() + static_cast<std::ptrdiff_t>(last), less);
+	});
+
+	// then sorted runs are merged pairwise, each merge of a round on its own thread
+	std::vector<uint32_t> buffer(size);
+	for (std::size_t width = 1; width < n; width *= 2)
+	{
+		const unsigned merges = static_cast<unsigned>((n + 2 * width - 1) / (2 * width));
+		parallel_detail::run(merges, [&](unsigned m)
+		{
+			const std::size_t left = bounds[m * 2 * width];
+			const std::size_t middle = bounds[std::min<std::size_t>(n, m * 2 * width + width)];
+			const std::size_t right = bounds[std::min<std::size_t>(n, (m + 1) * 2 * width)];
+
+			std::merge(indices.begin() + static_cast<std::ptrdiff_t>(left), indices.begin() + static_cast<std::ptrdiff_t>(middle),
+					   indices.begin() + static_cast<std::ptrdiff_t>(middle), indices.begin() + static_cast<std::ptrdiff_t>(right),
+					   buffer.begin() + static_cast<std::ptrdiff_t>(left), less);
+		});
+		indices.swap(buffer);
+	}
+
+	// the result is filled chunk by chunk, by the threads that sorted them
+	auto index = [&indices](std::size_t i) { return indices[i]; };
+	stable_vector<uint32_t, N> result;
+	parallel_detail::chunk_access::resize(result, size);
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			parallel_detail::chunk_access::construct(result, c, index);
+		}
+	});
+	return result;
+}
+
+// Iterates over the elements of a container in the order given by a permutation of its indices,
+// typically built by argsort(). The view owns the permutation; the container is referenced. Elements
+// a few positions ahead are prefetched, as the accesses are random.
+template <class StableVector, class Permutation>
+class sorted_view
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using size_type = std::size_t;
+
+	static constexpr std::size_t prefetch_distance = 8;
+
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = typename sorted_view::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type*;
+		using reference = const value_type&;
+
+		const_iterator(const sorted_view* view = nullptr, size_type i = 0) :
+			m_view(view),
+			m_index(i)
+		{}
+
+		reference operator*() const { return (*m_view)[m_index]; }
+		pointer operator->() const { return &**this; }
+
+		const_iterator& operator++()
+		{
+			++m_index;
+			m_view->prefetch(m_index + prefetch_distance);
+			return *this;
+		}
+
+		const_iterator operator++(int) { const_iterator it = *this; ++*this; return it; }
+
+		bool operator==(const const_iterator& it) const { return m_index == it.m_index; }
+		bool operator!=(const const_iterator& it) const { return m_index != it.m_index; }
+
+	private:
+		const sorted_view* m_view;
+		size_type m_index;
+	};
+
+	sorted_view(const StableVector& v, Permutation permutation) :
+		m_container(v),
+		m_permutation(std::move(permutation))
+	{
+	}
+
+	const_iterator begin() const
+	{
+		for (size_type i = 0; i < prefetch_distance; ++i)
+		{
+			prefetch(i);
+		}
+		return {this, 0};
+	}
+
+	const_iterator end() const { return {this, size()}; }
+
+	size_type size() const { return m_permutation.size(); }
+
+	const value_type& operator[](size_type i) const { return m_container[m_permutation[i]]; }
+
+	template <class F>
+	void for_each(F&& f) const
+	{
+		for (auto& t : *this)
+		{
+			f(t);
+		}
+	}
+
+private:
+	void prefetch(size_type i) const
+	{
+		if (i < size())
+		{
+			__builtin_prefetch(&m_container[m_permutation[i]]);
+		}
+	}
+
+	const StableVector& m_container;
+	Permutation m_permutation;
+};
+
+// The permutation is copied, or moved if it is an rvalue, e.g. make_sorted_view(v, argsort(v)).
+template <class StableVector, class Permutation>
+sorted_view<StableVector, std::decay_t<Permutation>> make_sorted_view(const StableVector& v, Permutation&& permutation)
+{
+	return sorted_view<StableVector, std::decay_t<Permutation>>(v, std::forward<Permutation>(permutation));
+}
+
+// Inclusive prefix scan of in into out: out[i] = in[0] op ... op in[i]. op needs to be associative,
+// but not commutative. out uses the same chunk size as in, and is grown to in.size() elements if it is
+// smaller; it may be in itself, to scan in place.
+//
+// Each thread scans its chunks, then the totals of the threads are scanned and every thread but the
+// first adds the total of the threads before it to its elements.
+template <class Input, class Output, class BinaryOp = std::plus<>>
+void inclusive_scan(const Input& in, Output& out, BinaryOp op = BinaryOp(), unsigned threads = 0)
+{
+	static_assert(Input::chunk_size == Output::chunk_size, "the output needs to be chunk-aligned with the input");
+	constexpr std::size_t N = Input::chunk_size;
+
+	const std::size_t size = in.size();
+	while (out.size() < size)
+	{
+		out.emplace_back();
+	}
+
+	const std::size_t chunks = parallel_detail::chunk_count(in);
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	std::vector<std::size_t> ends(n);
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		ends[t] = std::min(size, range.second * N);
+
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			const auto* src = in.chunk_data(c);
+			auto* dst = out.chunk_data(c);
+			const std::size_t length = in.chunk_length(c);
+
+			dst[0] = c == range.first ? src[0] : op(out.chunk_data(c - 1)[N - 1], src[0]);
+			for (std::size_t i = 1; i < length; ++i)
+			{
+				dst[i] = op(dst[i - 1], src[i]);
+			}
+		}
+	});
+
+	if (n == 1)
+	{
+		return;
+	}
+
+	// carries[t - 1]: total of the threads before t
+	std::vector<typename Output::value_type> carries;
+	carries.reserve(n - 1);
+	carries.push_back(out[ends[0] - 1]);
+	for (unsigned t = 1; t + 1 < n; ++t)
+	{
+		carries.push_back(op(carries.back(), out[ends[t] - 1]));
+	}
+
+	parallel_detail::run(n - 1, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t + 1);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			auto* dst = out.chunk_data(c);
+			const std::size_t length = in.chunk_length(c);
+			for (std::size_t i = 0; i < length; ++i)
+			{
+				dst[i] = op(carries[t], dst[i]);
+			}
+		}
+	});
+}
+
+// Exclusive prefix scan of in into out: out[0] = init, out[i] = init op in[0] op ... op in[i - 1].
+// Same requirements as inclusive_scan().
+//
+// As writing in place shifts the elements by one, the totals of the threads are computed first, and
+// each thread then scans its chunks starting from the total of the threads before it.
+template <class Input, class Output, class T, class BinaryOp = std::plus<>>
+void exclusive_scan(const Input& in, Output& out, T init, BinaryOp op = BinaryOp(), unsigned threads = 0)
+{
+	static_assert(Input::chunk_size == Output::chunk_size, "the output needs to be chunk-aligned with the input");
+	using value_type = typename Output::value_type;
+
+	const std::size_t size = in.size();
+	while (out.size() < size)
+	{
+		out.emplace_back();
+	}
+
+	const std::size_t chunks = parallel_detail::chunk_count(in);
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	std::vector<value_type> carries(n, value_type(init));
+	if (n > 1)
+	{
+		// the total of the last thread is not needed
+		std::vector<value_type> totals(n - 1, value_type(init));
+		parallel_detail::run(n - 1, [&](unsigned t)
+		{
+			const auto range = parallel_detail::chunk_range(chunks, n, t);
+			value_type total = in.chunk_data(range.first)[0];
+			for (std::size_t c = range.first; c < range.second; ++c)
+			{
+				const auto* src = in.chunk_data(c);
+				const std::size_t length = in.chunk_length(c);
+				for (std::size_t i = c == range.first ? 1 : 0; i < length; ++i)
+				{
+					total = op(total, src[i]);
+				}
+			}
+			totals[t] = std::move(total);
+		});
+
+		for (unsigned t = 1; t < n; ++t)
+		{
+			carries[t] = op(carries[t - 1], totals[t - 1]);
+		}
+	}
+
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		value_type acc = std::move(carries[t]);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			const auto* src = in.chunk_data(c);
+			auto* dst = out.chunk_data(c);
+			const std::size_t length = in.chunk_length(c);
+			for (std::size_t i = 0; i < length; ++i)
+			{
+				value_type next = op(acc, src[i]);
+				dst[i] = std::move(acc);
+				acc = std::move(next);
+			}
+		}
+	});
+}
+
+// Container of count elements, element i being constructed from f(i). Chunks are allocated and
+// filled in parallel, split among the threads as in the other algorithms. The workers are not pinned,
+// so this says nothing about the NUMA node the pages land on.
+//
+// f is called concurrently, and so is the allocator of the container. The observer of the container
+// is not called.
+template <class StableVector, class F>
+StableVector generate(std::size_t count, F f, unsigned threads = 0)
+{
+	constexpr std::size_t N = StableVector::chunk_size;
+
+	StableVector v;
+	parallel_detail::chunk_access::resize(v, count);
+
+	const std::size_t chunks = (count + N - 1) / N;
+	const unsigned n = parallel_detail::thread_count(threads, chunks);
+
+	parallel_detail::run(n, [&](unsigned t)
+	{
+		const auto range = parallel_detail::chunk_range(chunks, n, t);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			parallel_detail::chunk_access::construct(v, c, f);
+		}
+	});
+	return v;
+}
+
+// Deterministic reductions: each chunk is reduced on its own, and the partial results are combined
+// by a fixed pairwise tree over the chunks. Neither the split of the chunks among the threads nor the
+// scheduling change the order of the operations, so the result is bit-identical whatever the number
+// of threads (as long as the compiler does not reassociate floating-point operations, e.g. with
+// -ffast-math).
+
+enum class summation
+{
+	naive,    // independent lanes, which the compiler can vectorize
+	kahan,    // compensated lanes
+	pairwise  // recursive halving down to blocks summed with lanes
+};
+
+namespace parallel_detail {
+
+constexpr std::size_t sum_lanes = 4;
+constexpr std::size_t pairwise_block = 128;
+
+// element i is added to lane i % sum_lanes
+template <class T>
+T sum_naive(const T* data, std::size_t n)
+{
+	T lanes[sum_lanes] = {};
+	std::size_t i = 0;
+	for (; i + sum_lanes <= n; i += sum_lanes)
+	{
+		for (std::size_t l = 0; l < sum_lanes; ++l)
+		{
+			lanes[l] += data[i + l];
+		}
+	}
+	for (; i < n; ++i)
+	{
+		lanes[i % sum_lanes] += data[i];
+	}
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+template <class T>
+T sum_kahan(const T* data, std::size_t n)
+{
+	T sums[sum_lanes] = {};
+	T compensations[sum_lanes] = {};
+
+	auto add = [&](std::size_t l, T x)
+	{
+		const T y = x - compensations[l];
+		const T t = sums[l] + y;
+		compensations[l] = (t - sums[l]) - y;
+		sums[l] = t;
+	};
+
+	std::size_t i = 0;
+	for (; i + sum_lanes <= n; i += sum_lanes)
+	{
+		for (std::size_t l = 0; l < sum_lanes; ++l)
+		{
+			add(l, data[i + l]);
+		}
+	}
+	for (; i < n; ++i)
+	{
+		add(i % sum_lanes, data[i]);
+	}
+
+	// the lanes are merged into the first one, keeping the compensation
+	for (std::size_t l = 1; l < sum_lanes; ++l)
+	{
+		add(0, sums[l]);
+		add(0, -compensations[l]);
+	}
+	return sums[0] - compensations[0];
+}
+
+template <class T>
+T sum_pairwise(const T* data, std::size_t n)
+{
+	if (n <= pairwise_block)
+	{
+		return sum_naive(data, n);
+	}
+
+	const std::size_t half = n / 2;
+	return sum_pairwise(data, half) + sum_pairwise(data + half, n - half);
+}
+
+// Combines partial results pairwise: (p0 op p1) op (p2 op p3), ...
+template <class T, class BinaryOp>
+T reduce_tree(std::vector<T> partials, BinaryOp& op)
+{
+	for (std::size_t width = partials.size(); width > 1; width = (width + 1) / 2)
+	{
+		for (std::size_t i = 0; i < width / 2; ++i)
+		{
+			partials[i] = op(partials[2 * i], partials[2 * i + 1]);
+		}
+		if (width % 2)
+		{
+			partials[width / 2] = partials[width - 1];
+		}
+	}
+	return partials.front();
+}
+
+// Calls reduce_chunk(data, length) on every chunk of v, in parallel, then combines the results.
+template <class T, class StableVector, class ReduceChunk, class BinaryOp>
+T reduce_chunks(const StableVector& v, T identity, ReduceChunk&& reduce_chunk, BinaryOp& op, unsigned threads)
+{
+	const std::size_t chunks = chunk_count(v);
+	if (chunks == 0)
+	{
+		return identity;
+	}
+
+	const unsigned n = thread_count(threads, chunks);
+	std::vector<T> partials(chunks, identity);
+	run(n, [&](unsigned t)
+	{
+		const auto range = chunk_range(chunks, n, t);
+		for (std::size_t c = range.first; c < range.second; ++c)
+		{
+			partials[c] = reduce_chunk(v.chunk_data(c), v.chunk_length(c));
+		}
+	});
+	return reduce_tree(std::move(partials), op);
+}
+
+}
+
+// Reduction of the elements of v with op, which needs to be associative: each chunk is folded from
+// left to right starting from identity, and the results of the chunks are combined pairwise.
+template <class StableVector, class T, class BinaryOp>
+T deterministic_reduce(const StableVector& v, T identity, BinaryOp op, unsigned threads = 0)
+{
+	auto fold = [&identity, &op](const typename StableVector::value_type* data, std::size_t n)
+	{
+		T acc = identity;
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			acc = op(acc, data[i]);
+		}
+		return acc;
+	};
+	return parallel_detail::reduce_chunks(v, identity, fold, op, threads);
+}
+
+// Sum of the floating-point elements of v, bit-identical whatever the number of threads.
+template <class StableVector>
+typename StableVector::value_type deterministic_sum(const StableVector& v, summation method = summation::pairwise, unsigned threads = 0)
+{
+	using value_type = typename StableVector::value_type;
+	static_assert(std::is_floating_point<value_type>::value, "deterministic_sum() sums floating-point elements");
+
+	auto sum_chunk = [method](const value_type* data, std::size_t n)
+	{
+		switch (method)
+		{
+			case summation::naive:    return parallel_detail::sum_naive(data, n);
+			case summation::kahan:    return parallel_detail::sum_kahan(data, n);
+			case summation::pairwise: return parallel_detail::sum_pairwise(data, n);
+		}
+		return value_type();
+	};
+
+	std::plus<value_type> plus;
+	return parallel_detail::reduce_chunks(v, value_type(), sum_chunk, plus, threads);
+}
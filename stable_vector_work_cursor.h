@@ -0,0 +1,171 @@
+#pragma once
+
+#include "stable_vector.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Distributes the elements appended to a stable_vector among a pool of workers, each element being
+// handed out exactly once. The producer appends to the container and publishes the new elements;
+// workers claim batches of published elements, as contiguous spans that never cross a chunk
+// boundary, and wait when everything published has been claimed.
+//
+// Batches are sized like guided scheduling: a share of the unclaimed elements proportional to the
+// number of workers, within [min_batch, chunk_size], so that workers take large batches when far
+// behind the producer and small ones when close to it.
+//
+// Only the producer thread accesses the container; workers only see the chunk addresses recorded by
+// publish(), which never change while elements are only appended. The container must not be cleared,
+// assigned, moved or destroyed while the cursor is in use, as the recorded addresses would dangle.
+template <class StableVector>
+class work_cursor
+{
+public:
+	using value_type = typename StableVector::value_type;
+	using size_type = std::size_t;
+
+	static constexpr std::size_t chunk_size = StableVector::chunk_size;
+
+	struct batch
+	{
+		size_type first = 0;               // index of data[0] in the container
+		const value_type* data = nullptr;
+		size_type count = 0;
+
+		bool empty() const noexcept { return count == 0; }
+		const value_type* begin() const noexcept { return data; }
+		const value_type* end() const noexcept { return data + count; }
+	};
+
+	explicit work_cursor(unsigned workers, size_type min_batch = 64) :
+		m_workers(workers ? workers : 1),
+		m_min_batch(std::max<size_type>(1, std::min<size_type>(min_batch, chunk_size)))
+	{
+	}
+
+	// Producer: makes the elements of v appended since the last call available to the workers.
+	void publish(const StableVector& v);
+
+	// Producer: no more elements will be published; workers are released once everything is claimed.
+	void close();
+
+	// Claims the next batch, waiting for the producer if needed. Returns an empty batch once the
+	// cursor is closed and all the elements have been claimed.
+	batch claim();
+
+	// Same as claim(), but returns an empty batch instead of waiting.
+	batch try_claim();
+
+	size_type published() const;
+	size_type claimed() const;
+
+private:
+	batch next(size_type available);
+
+	const size_type m_workers;
+	const size_type m_min_batch;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_available;
+
+	std::vector<const value_type*> m_chunks;
+	size_type m_published = 0;
+	size_type m_claimed = 0;
+	bool m_closed = false;
+};
+
+
+
+
+
+
+template <class StableVector>
+constexpr const std::size_t work_cursor<StableVector>::chunk_size;
+
+template <class StableVector>
+void work_cursor<StableVector>::publish(const StableVector& v)
+{
+	const size_type size = v.size();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(size >= m_published && "elements were removed from a published container");
+		if (size == m_published)
+		{
+			return;
+		}
+
+		for (size_type c = m_chunks.size(); c * chunk_size < size; ++c)
+		{
+			m_chunks.push_back(v.chunk_data(c));
+		}
+		m_published = size;
+	}
+	m_available.notify_all();
+}
+
+template <class StableVector>
+void work_cursor<StableVector>::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+	}
+	m_available.notify_all();
+}
+
+template <class StableVector>
+typename work_cursor<StableVector>::batch work_cursor<StableVector>::next(size_type available)
+{
+	const size_type offset = m_claimed % chunk_size;
+
+	size_type count = std::max(m_min_batch, available / (2 * m_workers));
+	count = std::min({count, available, chunk_size - offset});
+
+	batch b;
+	b.first = m_claimed;
+	b.data = m_chunks[m_claimed / chunk_size] + offset;
+	b.count = count;
+
+	m_claimed += count;
+	return b;
+}
+
+template <class StableVector>
+typename work_cursor<StableVector>::batch work_cursor<StableVector>::claim()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_available.wait(lock, [this]() { return m_claimed < m_published || m_closed; });
+
+	if (m_claimed == m_published)
+	{
+		return batch();
+	}
+	return next(m_published - m_claimed);
+}
+
+template <class StableVector>
+typename work_cursor<StableVector>::batch work_cursor<StableVector>::try_claim()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_claimed == m_published)
+	{
+		return batch();
+	}
+	return next(m_published - m_claimed);
+}
+
+template <class StableVector>
+typename work_cursor<StableVector>::size_type work_cursor<StableVector>::published() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_published;
+}
+
+template <class StableVector>
+typename work_cursor<StableVector>::size_type work_cursor<StableVector>::claimed() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_claimed;
+}
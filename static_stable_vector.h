@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+// Fixed-capacity counterpart of stable_vector usable in constant expressions, to build lookup tables
+// at compile time: a constexpr static_stable_vector is placed in read-only data and costs nothing at
+// startup. It has the same interface as stable_vector for reading and appending, including the chunk
+// accessors, so that the companion types (indexes, checksums, ...) work with both.
+//
+// Elements are stored contiguously, and must be literal types with a default constructor.
+template <class T, std::size_t Capacity, std::size_t ChunkSize = 1024>
+class static_stable_vector
+{
+	static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize needs to be a power of 2");
+
+public:
+	using value_type = T;
+	using reference = value_type&;
+	using const_reference = const value_type&;
+	using pointer = value_type*;
+	using const_pointer = const value_type*;
+	using iterator = pointer;
+	using const_iterator = const_pointer;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	static constexpr const std::size_t chunk_size = ChunkSize;
+
+	constexpr static_stable_vector() = default;
+
+	constexpr static_stable_vector(std::initializer_list<T> ilist)
+	{
+		for (const T& t : ilist)
+		{
+			push_back(t);
+		}
+	}
+
+	constexpr iterator begin() noexcept { return m_data; }
+	constexpr const_iterator begin() const noexcept { return m_data; }
+	constexpr const_iterator cbegin() const noexcept { return begin(); }
+
+	constexpr iterator end() noexcept { return m_data + m_size; }
+	constexpr const_iterator end() const noexcept { return m_data + m_size; }
+	constexpr const_iterator cend() const noexcept { return end(); }
+
+	constexpr size_type size() const noexcept { return m_size; }
+	constexpr size_type max_size() const noexcept { return Capacity; }
+	constexpr size_type capacity() const noexcept { return Capacity; }
+
+	constexpr bool empty() const noexcept { return m_size == 0; }
+
+	constexpr bool operator==(const static_stable_vector& v) const
+	{
+		if (m_size != v.m_size)
+		{
+			return false;
+		}
+		for (size_type i = 0; i < m_size; ++i)
+		{
+			if (!(m_data[i] == v.m_data[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constexpr bool operator!=(const static_stable_vector& v) const { return !operator==(v); }
+
+	constexpr reference front()             { return m_data[0]; }
+	constexpr const_reference front() const { return m_data[0]; }
+
+	constexpr reference back()             { return m_data[m_size - 1]; }
+	constexpr const_reference back() const { return m_data[m_size - 1]; }
+
+	// Exceeding the capacity throws std::length_error, which fails the compilation in a constant expression.
+	constexpr void push_back(const T& t)
+	{
+		check_capacity();
+		m_data[m_size++] = t;
+	}
+
+	template <class... Args>
+	constexpr void emplace_back(Args&&... args)
+	{
+		check_capacity();
+		m_data[m_size++] = T(std::forward<Args>(args)...);
+	}
+
+	constexpr void clear() noexcept { m_size = 0; }
+
+	constexpr reference operator[](size_type i) { return m_data[i]; }
+	constexpr const_reference operator[](size_type i) const { return m_data[i]; }
+
+	constexpr reference at(size_type i)
+	{
+		if (i >= m_size)
+		{
+			throw std::out_of_range("out of range");
+		}
+		return m_data[i];
+	}
+
+	constexpr const_reference at(size_type i) const
+	{
+		if (i >= m_size)
+		{
+			throw std::out_of_range("out of range");
+		}
+		return m_data[i];
+	}
+
+	constexpr size_type chunk_count() const noexcept { return (m_size + ChunkSize - 1) / ChunkSize; }
+	constexpr size_type chunk_length(size_type c) const noexcept { return m_size > c * ChunkSize ? std::min(ChunkSize, m_size - c * ChunkSize) : 0; }
+
+	constexpr pointer chunk_data(size_type c) noexcept { return m_data + c * ChunkSize; }
+	constexpr const_pointer chunk_data(size_type c) const noexcept { return m_data + c * ChunkSize; }
+
+private:
+	constexpr void check_capacity() const
+	{
+		if (m_size == Capacity)
+		{
+			throw std::length_error("static_stable_vector: capacity exceeded");
+		}
+	}
+
+	T m_data[Capacity] = {};
+	size_type m_size = 0;
+};
+
+template <class T, std::size_t Capacity, std::size_t ChunkSize>
+constexpr const std::size_t static_stable_vector<T, Capacity, ChunkSize>::chunk_size;
@@ -1,12 +1,31 @@
 #include "stable_vector.h"
+#include "stable_vector_arrow.h"
+#include "stable_vector_bloom.h"
+#include "stable_vector_bitmap.h"
+#include "stable_vector_checksum.h"
+#include "stable_vector_file.h"
+#include "stable_vector_list.h"
+#include "stable_vector_heap.h"
+#include "stable_vector_diff.h"
+#include "stable_vector_btree.h"
+#include "stable_vector_parallel.h"
+#include "stable_vector_work_cursor.h"
+#include "static_stable_vector.h"
+#include "stable_multi_vector.h"
+#include "stable_spsc_queue.h"
 
 #include <boost/noncopyable.hpp>
 #include <boost/container/stable_vector.hpp>
 #include <gtest/gtest.h>
 
 #include <list>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <random>
 #include <vector>
 #include <chrono>
+#include <thread>
 
 struct A
 {
@@ -284,12 +303,336 @@ TEST(stable_vector, reserve)
 	ASSERT_EQ(48, v2.capacity());
 }
 
+TEST(stable_vector, reserve_then_push_back)
+{
+	stable_vector<int, 4> v;
+	v.reserve(10);
+
+	for (int i = 0; i < 6; ++i)
+		v.push_back(i);
+
+	ASSERT_EQ(6, v.size());
+	ASSERT_EQ(12, v.capacity());
+	ASSERT_EQ(5, v.back());
+	ASSERT_EQ(std::accumulate(v.cbegin(), v.cend(), 0), 0 + 1 + 2 + 3 + 4 + 5);
+}
+
+TEST(stable_vector_batch, commit)
+{
+	stable_vector<int, 4> v = {0, 1, 2};
+
+	v.begin_batch();
+	for (int i = 3; i < 10; ++i)
+		v.push_back(i);
+
+	ASSERT_TRUE(v.in_batch());
+	ASSERT_EQ(3, v.size());
+	ASSERT_EQ(7, v.batch_size());
+	ASSERT_EQ(2, v.back());
+	ASSERT_EQ(9, v[9]);
+	ASSERT_THROW(v.at(3), std::out_of_range);
+
+	v.commit();
+	ASSERT_FALSE(v.in_batch());
+	ASSERT_EQ(10, v.size());
+	ASSERT_EQ(9, v.back());
+}
+
+TEST(stable_vector_batch, rollback)
+{
+	stable_vector<CallCounter<>, 4> v(3);
+	const auto* first = &v[0];
+
+	CallCounter<>::reset_counters();
+	v.begin_batch();
+	for (int i = 0; i < 7; ++i)
+		v.emplace_back();
+
+	ASSERT_EQ(12, v.capacity());
+	v.rollback();
+
+	ASSERT_FALSE(v.in_batch());
+	ASSERT_EQ(3, v.size());
+	ASSERT_EQ(4, v.capacity());
+	ASSERT_EQ(7, CallCounter<>::constructions);
+	ASSERT_EQ(7, CallCounter<>::destructions);
+	ASSERT_EQ(first, &v[0]);
+
+	v.emplace_back();
+	ASSERT_EQ(4, v.size());
+}
+
+TEST(stable_vector_batch, rollback_keeps_reserved_chunks)
+{
+	stable_vector<int, 4> v;
+	v.reserve(8);
+
+	v.begin_batch();
+	for (int i = 0; i < 6; ++i)
+		v.push_back(i);
+	v.rollback();
+
+	ASSERT_TRUE(v.empty());
+	ASSERT_EQ(8, v.capacity());
+
+	v.push_back(42);
+	ASSERT_EQ(42, v.front());
+}
+
+template <class T>
+struct counting_allocator
+{
+	using value_type = T;
+
+	counting_allocator() = default;
+	template <class U> counting_allocator(const counting_allocator<U>&) {}
+
+	T* allocate(std::size_t n) { ++allocations; return std::allocator<T>().allocate(n); }
+	void deallocate(T* p, std::size_t n) { ++deallocations; std::allocator<T>().deallocate(p, n); }
+
+	template <class U> bool operator==(const counting_allocator<U>&) const { return true; }
+	template <class U> bool operator!=(const counting_allocator<U>&) const { return false; }
+
+	static int allocations;
+	static int deallocations;
+};
+
+template <class T> int counting_allocator<T>::allocations = 0;
+template <class T> int counting_allocator<T>::deallocations = 0;
+
+TEST(stable_vector, copy_assignment_reuses_chunks)
+{
+	using vector_type = stable_vector<long, 4, counting_allocator<long>>;
+	using chunk_allocator = counting_allocator<boost::container::static_vector<long, 4>>;
+
+	vector_type v1 = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+	vector_type v2 = {10, 20};
+	vector_type v3 = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	const int allocations = chunk_allocator::allocations;
+	v3 = v1;
+	ASSERT_EQ(v1, v3);
+	v3 = v2;
+	ASSERT_EQ(v2, v3);
+	ASSERT_EQ(12, v3.capacity());
+	v3 = v1;
+	ASSERT_EQ(v1, v3);
+	ASSERT_EQ(allocations, chunk_allocator::allocations);
+}
+
+TEST(stable_vector, copy_assignment_batch)
+{
+	stable_vector<int, 4> other = {7, 8};
+	other.reserve(12);
+	other.begin_batch();
+	other.push_back(1);
+
+	// the open batch of other is not copied
+	stable_vector<int, 4> t;
+	t = other;
+	ASSERT_FALSE(t.in_batch());
+	ASSERT_EQ((std::vector<int>{7, 8}), std::vector<int>(t.begin(), t.end()));
+
+	t.begin_batch();
+	t.push_back(3);
+	t.rollback();
+	ASSERT_EQ(2, t.size());
+
+	// nor is an open batch of the destination kept
+	t.begin_batch();
+	t.push_back(4);
+	t = other;
+	ASSERT_FALSE(t.in_batch());
+	ASSERT_EQ(2, t.size());
+	t.push_back(5);
+	ASSERT_EQ(5, t[2]);
+	other.rollback();
+}
+
+TEST(stable_vector, assign)
+{
+	stable_vector<std::string, 4> v = {"a", "b", "c", "d", "e", "f"};
+	const std::vector<std::string> longer = {"1", "2", "3", "4", "5", "6", "7", "8", "9"};
+	const std::list<std::string> shorter = {"x", "y"};
+
+	v.assign(longer.begin(), longer.end());
+	ASSERT_TRUE(std::equal(longer.begin(), longer.end(), v.begin(), v.end()));
+
+	v.assign(shorter.begin(), shorter.end());
+	ASSERT_TRUE(std::equal(shorter.begin(), shorter.end(), v.begin(), v.end()));
+	ASSERT_EQ(12, v.capacity());
+
+	v.assign(5, "z");
+	ASSERT_EQ(5, v.size());
+	ASSERT_TRUE(std::all_of(v.begin(), v.end(), [](const std::string& s) { return s == "z"; }));
+
+	v.push_back("end");
+	ASSERT_EQ("end", v[5]);
+}
+
+TEST(stable_vector, assign_trivial)
+{
+	auto p = std::make_shared<int>(0);
+	stable_vector<int, 4> v(10, 7);
+	const int values[] = {1, 2, 3, 4, 5, 6};
+
+	v.assign(std::begin(values), std::end(values));
+	ASSERT_EQ((stable_vector<int, 4>({1, 2, 3, 4, 5, 6})), v);
+
+	v.assign({9, 8});
+	ASSERT_EQ((stable_vector<int, 4>({9, 8})), v);
+
+	stable_vector<std::shared_ptr<int>, 4> shared(9, p);
+	shared.assign(2, nullptr);
+	ASSERT_EQ(1, p.use_count());
+}
+
+TEST(stable_vector, allocator)
+{
+	using vector_type = stable_vector<int, 4, counting_allocator<int>>;
+	using chunk_allocator = counting_allocator<boost::container::static_vector<int, 4>>;
+
+	{
+		vector_type v = {1, 2, 3, 4, 5};
+		ASSERT_EQ(2, chunk_allocator::allocations);
+
+		vector_type v2(v);
+		ASSERT_EQ(4, chunk_allocator::allocations);
+
+		v2.clear();
+		ASSERT_EQ(2, chunk_allocator::deallocations);
+	}
+
+	ASSERT_EQ(4, chunk_allocator::deallocations);
+}
+
+struct summary_observer : null_observer
+{
+	void on_append(std::size_t index, const int& i) { last_index = index; sum += i; }
+	void on_chunk_added(std::size_t) { ++chunks_added; }
+	void on_chunk_sealed(std::size_t c, const int* data) { sealed.push_back(c); sealed_first.push_back(data[0]); }
+	void on_rollback(std::size_t new_size) noexcept { rolled_back_to = new_size; }
+	void on_clear() noexcept { ++clears; sum = 0; }
+
+	std::size_t rolled_back_to = 0;
+	int clears = 0;
+	std::size_t last_index = 0;
+	long long sum = 0;
+	int chunks_added = 0;
+	std::vector<std::size_t> sealed;
+	std::vector<int> sealed_first;
+};
+
+TEST(stable_vector_observer, hooks)
+{
+	stable_vector<int, 4, std::allocator<int>, summary_observer> v;
+	for (int i = 0; i < 10; ++i)
+		v.push_back(i);
+	v.emplace_back(10);
+
+	const auto& o = v.get_observer();
+	ASSERT_EQ(10, o.last_index);
+	ASSERT_EQ(55, o.sum);
+	ASSERT_EQ(3, o.chunks_added);
+	ASSERT_EQ(std::vector<std::size_t>({0, 1}), o.sealed);
+	ASSERT_EQ(std::vector<int>({0, 4}), o.sealed_first);
+
+	v.reserve(20);
+	ASSERT_EQ(5, v.get_observer().chunks_added);
+
+	// the observer follows the elements
+	decltype(v) w;
+	w = std::move(v);
+	ASSERT_EQ(55, w.get_observer().sum);
+
+	auto frozen = w.freeze();
+	ASSERT_EQ(11, frozen.size());
+	ASSERT_EQ(1, w.get_observer().clears);
+}
+
+TEST(stable_vector_observer, copy_assignment)
+{
+	stable_vector<int, 4, std::allocator<int>, summary_observer> v = {1, 2, 3};
+	stable_vector<int, 4, std::allocator<int>, summary_observer> w = {10, 20};
+
+	// the destination keeps its observer, told of a clear and of the copied elements
+	w = v;
+	ASSERT_EQ(1, w.get_observer().clears);
+	ASSERT_EQ(6, w.get_observer().sum);
+	ASSERT_EQ(2, w.get_observer().last_index);
+}
+
+TEST(stable_vector_observer, removals)
+{
+	stable_vector<int, 4, std::allocator<int>, summary_observer> v = {1, 2, 3};
+
+	v.begin_batch();
+	v.push_back(4);
+	v.push_back(5);
+	v.rollback();
+	ASSERT_EQ(3, v.get_observer().rolled_back_to);
+
+	v.assign({7, 8});
+	ASSERT_EQ(1, v.get_observer().clears);
+	ASSERT_EQ(15, v.get_observer().sum);
+
+	v.clear();
+	ASSERT_EQ(2, v.get_observer().clears);
+	ASSERT_EQ(0, v.get_observer().sum);
+}
+
+struct byte_observer : null_observer
+{
+	char byte = 0;
+};
+
+TEST(stable_vector_observer, empty_base)
+{
+	// the default observer takes no space
+	ASSERT_LT(sizeof(stable_vector<int, 4>), sizeof(stable_vector<int, 4, std::allocator<int>, byte_observer>));
+}
+
 TEST(stable_vector_multiple_chunks, init)
 {
 	stable_vector<int, 4> v = {1, 2, 3, 4, 5, 6, 7, 8, 9};
 	ASSERT_EQ(v.size(), 9);
 }
 
+TEST(stable_vector_multiple_chunks, for_each_indexed)
+{
+	stable_vector<int, 4> v = {0, 10, 20, 30, 40, 50};
+
+	v.for_each_indexed([](std::size_t i, int& t) { t += static_cast<int>(i); });
+
+	std::vector<std::pair<std::size_t, int>> seen;
+	const auto& c = v;
+	c.for_each_indexed([&seen](std::size_t i, const int& t) { seen.emplace_back(i, t); });
+
+	ASSERT_EQ(6, seen.size());
+	for (std::size_t i = 0; i < seen.size(); ++i)
+	{
+		ASSERT_EQ(i, seen[i].first);
+		ASSERT_EQ(static_cast<int>(i * 11), seen[i].second);
+	}
+}
+
+TEST(stable_vector_multiple_chunks, for_each_chunk)
+{
+	stable_vector<int, 4> v = {1, 2, 3, 4, 5, 6};
+	v.reserve(16);
+
+	std::vector<std::pair<std::size_t, std::size_t>> chunks;
+	int sum = 0;
+	v.for_each_chunk([&](std::size_t base, chunk_span<int> span)
+	{
+		chunks.emplace_back(base, span.size());
+		sum = std::accumulate(span.begin(), span.end(), sum);
+	});
+
+	ASSERT_EQ((std::vector<std::pair<std::size_t, std::size_t>>{{0, 4}, {4, 2}}), chunks);
+	ASSERT_EQ(21, sum);
+}
+
 TEST(stable_vector_multiple_chunks, copy)
 {
 	stable_vector<int, 4> v = {1, 2, 3, 4, 5, 6, 7, 8, 9};
@@ -373,47 +716,1705 @@ TEST(stable_vector_iterator, arithmetic)
 	ASSERT_TRUE(it == v.begin());
 }
 
-template <class ContainerT>
-int sum(const ContainerT& v)
+TEST(frozen_stable_vector, freeze)
 {
+	stable_vector<int, 4> v = {0, 1, 2, 3, 4, 5};
+	v.reserve(20);
+	const int* first = &v[0];
+
+	auto f = v.freeze();
+	ASSERT_TRUE(v.empty());
+	ASSERT_EQ(0, v.capacity());
+
+	ASSERT_EQ(6, f.size());
+	ASSERT_EQ(2, f.chunk_count());
+	ASSERT_EQ(4, f.chunk_length(0));
+	ASSERT_EQ(2, f.chunk_length(1));
+	ASSERT_EQ(first, &f[0]);
+	ASSERT_EQ(5, f.back());
+	ASSERT_THROW(f.at(6), std::out_of_range);
+	ASSERT_EQ(std::accumulate(f.cbegin(), f.cend(), 0), 0 + 1 + 2 + 3 + 4 + 5);
+
 	int sum = 0;
-	auto start = std::chrono::high_resolution_clock::now();
-	for (const auto& i : v)
+	f.for_each([&sum](int i) { sum += i; });
+	ASSERT_EQ(15, sum);
+}
+
+TEST(frozen_stable_vector, keep_tail)
+{
+	stable_vector<int, 4> v = {0, 1, 2, 3, 4, 5};
+	const int* tail = &v[4];
+
+	freeze_options options;
+	options.shrink_tail = false;
+	auto f = v.freeze(options);
+
+	ASSERT_EQ(tail, &f[4]);
+	ASSERT_EQ(2, f.chunk_length(1));
+}
+
+TEST(frozen_stable_vector, destroys_elements)
+{
 	{
-		sum += i;
+		stable_vector<CallCounter<true>, 4> v(6);
+		CallCounter<true>::reset_counters();
+
+		auto f = v.freeze();
+		ASSERT_EQ(2, CallCounter<true>::move_constructions);
+		ASSERT_EQ(2, CallCounter<true>::destructions);
+
+		frozen_stable_vector<CallCounter<true>, 4, std::allocator<CallCounter<true>>> f2(std::move(f));
+		ASSERT_TRUE(f.empty());
+		ASSERT_EQ(6, f2.size());
 	}
-	auto end = std::chrono::high_resolution_clock::now();
 
-	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
-	return sum;
+	ASSERT_EQ(8, CallCounter<true>::destructions);
 }
 
-static std::size_t ElementsCount = 10000000;
+TEST(frozen_stable_vector, protect_pages)
+{
+	stable_vector<int, 4096> v(10000, 7);
+
+	freeze_options options;
+	options.protect_pages = true;
+	auto f = v.freeze(options);
+
+	ASSERT_TRUE(f.is_protected());
+	ASSERT_EQ(7, f[9999]);
+	ASSERT_DEATH(const_cast<int&>(f[2048]) = 0, "");
+
+	// every element is protected, whatever the chunk size
+	stable_vector<double> w(3000, 1.5);
+	auto g = w.freeze(options);
+	ASSERT_TRUE(g.is_protected());
+	ASSERT_EQ(3, g.chunk_count());
+	ASSERT_EQ(1.5, g[2999]);
+	ASSERT_DEATH(const_cast<double&>(g[0]) = 0, "");
+	ASSERT_DEATH(const_cast<double&>(g[1023]) = 0, "");
+	ASSERT_DEATH(const_cast<double&>(g[2999]) = 0, "");
+}
 
-TEST(stable_vector_iterator, performance)
+TEST(frozen_stable_vector, budget)
 {
-	stable_vector<int, 4096> v(ElementsCount, 1);
-	int s = sum(v);
-	EXPECT_EQ(ElementsCount, s);
+	memory_budget budget(std::numeric_limits<std::size_t>::max());
+	{
+		stable_vector<int, 16> v;
+		v.set_memory_budget(&budget);
+		for (int i = 0; i < 21; ++i)
+			v.push_back(i);
+		const std::size_t chunk_bytes = budget.used() / 2;
+
+		// the shrunk tail is charged, the last chunk released
+		auto f = v.freeze();
+		ASSERT_EQ(chunk_bytes + 5 * sizeof(int), budget.used());
+	}
+	ASSERT_EQ(0, budget.used());
+
+	{
+		stable_vector<int, 16> v;
+		v.set_memory_budget(&budget);
+		for (int i = 0; i < 21; ++i)
+			v.push_back(i);
+
+		freeze_options options;
+		options.protect_pages = true;
+		auto f = v.freeze(options);
+		ASSERT_EQ(static_cast<std::size_t>(sysconf(_SC_PAGESIZE)), budget.used());
+	}
+	ASSERT_EQ(0, budget.used());
 }
 
-TEST(boost_stable_vector_iterator, performance)
+TEST(stable_vector_memory_budget, fail)
 {
-	boost::container::stable_vector<int> v(ElementsCount, 1);
-	int s = sum(v);
-	EXPECT_EQ(ElementsCount, s);
+	memory_budget budget(std::numeric_limits<std::size_t>::max());
+
+	stable_vector<int, 4> v;
+	v.set_memory_budget(&budget);
+	v.push_back(0);
+
+	const std::size_t chunk_bytes = budget.used();
+	ASSERT_GT(chunk_bytes, 4 * sizeof(int));
+
+	budget.set_limit(2 * chunk_bytes);
+	for (int i = 1; i < 8; ++i)
+		v.push_back(i);
+	ASSERT_EQ(2 * chunk_bytes, budget.used());
+
+	ASSERT_THROW(v.push_back(8), memory_budget_exceeded);
+	ASSERT_EQ(8, v.size());
+
+	v.clear();
+	ASSERT_EQ(0, budget.used());
 }
 
-TEST(list_iterator, performance)
+TEST(stable_vector_memory_budget, shared)
 {
-	std::list<int> v(ElementsCount, 1);
-	int s = sum(v);
-	EXPECT_EQ(ElementsCount, s);
+	memory_budget budget(std::numeric_limits<std::size_t>::max());
+	std::size_t chunk_bytes;
+
+	{
+		stable_vector<int, 4> v1;
+		v1.set_memory_budget(&budget);
+		v1.push_back(0);
+		chunk_bytes = budget.used();
+
+		stable_vector<int, 4> v2(v1);
+		ASSERT_EQ(2 * chunk_bytes, budget.used());
+
+		stable_vector<int, 4> v3(std::move(v2));
+		ASSERT_EQ(2 * chunk_bytes, budget.used());
+
+		// copy assignment allocates through the budget of the destination
+		stable_vector<int, 4> v4;
+		v4 = v1;
+		ASSERT_EQ(2 * chunk_bytes, budget.used());
+		ASSERT_EQ(nullptr, v4.get_memory_budget());
+	}
+
+	ASSERT_EQ(0, budget.used());
 }
 
-TEST(std_vector_iterator, performance)
+TEST(stable_vector_memory_budget, global)
 {
-	std::vector<int> v(10000000, 1);
-	int s = sum(v);
-	std::cout << s << std::endl;
+	memory_budget budget(std::numeric_limits<std::size_t>::max());
+	memory_budget::set_global(&budget);
+
+	{
+		stable_vector<int, 4> v = {1, 2, 3, 4, 5};
+		ASSERT_EQ(&budget, v.get_memory_budget());
+		ASSERT_GT(budget.used(), 0);
+	}
+
+	memory_budget::set_global(nullptr);
+	ASSERT_EQ(0, budget.used());
+}
+
+TEST(stable_vector_memory_budget, block)
+{
+	memory_budget budget(std::numeric_limits<std::size_t>::max(), memory_budget::policy::block);
+
+	stable_vector<int, 4> consumed;
+	consumed.set_memory_budget(&budget);
+	consumed.push_back(0);
+	budget.set_limit(budget.used());
+
+	stable_vector<int, 4> producer;
+	producer.set_memory_budget(&budget);
+
+	std::thread consumer([&consumed]()
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		consumed.clear();
+	});
+
+	producer.push_back(1);
+	consumer.join();
+
+	ASSERT_EQ(1, producer.size());
+	ASSERT_TRUE(consumed.empty());
+}
+
+TEST(stable_vector_memory_budget, block_fails)
+{
+	// a chunk larger than the limit can never fit
+	memory_budget small(16, memory_budget::policy::block);
+	stable_vector<int, 16> v;
+	v.set_memory_budget(&small);
+	ASSERT_THROW(v.push_back(0), memory_budget_exceeded);
+
+	// nobody releases memory
+	memory_budget budget(std::numeric_limits<std::size_t>::max(), memory_budget::policy::block, std::chrono::milliseconds(10));
+	stable_vector<int, 4> w;
+	w.set_memory_budget(&budget);
+	w.push_back(0);
+	budget.set_limit(budget.used());
+
+	for (int i = 1; i < 4; ++i)
+		w.push_back(i);
+	ASSERT_THROW(w.push_back(4), memory_budget_exceeded);
+	ASSERT_EQ(4, w.size());
+}
+
+TEST(stable_vector_memory_budget, callback)
+{
+	std::vector<std::size_t> requests;
+	memory_budget* budget_ptr = nullptr;
+	memory_budget budget(0, [&](std::size_t requested)
+	{
+		requests.push_back(requested);
+		if (requests.size() > 1)
+			return false;
+
+		budget_ptr->set_limit(requested);
+		return true;
+	});
+	budget_ptr = &budget;
+
+	stable_vector<int, 4> v;
+	v.set_memory_budget(&budget);
+	for (int i = 0; i < 4; ++i)
+		v.push_back(i);
+	ASSERT_EQ(1, requests.size());
+
+	ASSERT_THROW(v.push_back(4), memory_budget_exceeded);
+	ASSERT_EQ(2, requests.size());
+	ASSERT_EQ(4, v.size());
+}
+
+struct order
+{
+	uint64_t id;
+	int price;
+};
+
+struct order_id
+{
+	uint64_t operator()(const order& o) const { return o.id; }
+};
+
+TEST(chunk_bloom_index, find)
+{
+	using vector_type = stable_vector<order, 256>;
+	vector_type v;
+	chunk_bloom_index<vector_type, order_id> index;
+
+	for (uint64_t i = 0; i < 4000; ++i)
+		v.push_back({i * 7919 % 100003, static_cast<int>(i)});
+	index.update(v);
+	ASSERT_EQ(4000, index.indexed_size());
+
+	std::vector<std::size_t> found;
+	index.find(v, 1234 * 7919 % 100003, [&found](std::size_t i, const order& o)
+	{
+		found.push_back(i);
+		ASSERT_EQ(1234, o.price);
+	});
+	ASSERT_EQ(std::vector<std::size_t>{1234}, found);
+
+	// no false negatives, and few false positives
+	std::size_t candidate_chunks = 0;
+	for (uint64_t i = 0; i < 4000; ++i)
+	{
+		const uint64_t id = i * 7919 % 100003;
+		ASSERT_TRUE(index.may_contain(i / 256, id));
+		for (std::size_t c = 0; c < v.chunk_count(); ++c)
+			candidate_chunks += index.may_contain(c, id);
+	}
+	ASSERT_LT(candidate_chunks, 4000 * 2);
+}
+
+TEST(chunk_bloom_index, false_positive_rate)
+{
+	using vector_type = stable_vector<order, 1024>;
+	vector_type v;
+	chunk_bloom_index<vector_type, order_id> index;
+
+	// sequential keys, as std::hash leaves them
+	for (uint64_t i = 0; i < 16 * 1024; ++i)
+		v.push_back({i, 0});
+	index.update(v);
+
+	// the target is about 1% with 10 bits per element
+	std::size_t positives = 0;
+	const std::size_t queries = 100000;
+	for (uint64_t i = 0; i < queries; ++i)
+		positives += index.may_contain(i % 16, (uint64_t(1) << 40) + i);
+	ASSERT_LT(static_cast<double>(positives) / queries, 0.02);
+}
+
+TEST(chunk_bloom_index, unindexed_elements)
+{
+	using vector_type = stable_vector<order, 16>;
+	vector_type v;
+	chunk_bloom_index<vector_type, order_id> index;
+
+	v.push_back({1, 0});
+	index.update(v);
+	v.push_back({2, 1});
+	v.push_back({1, 2});
+
+	std::vector<std::size_t> found;
+	index.find(v, 1, [&found](std::size_t i, const order&) { found.push_back(i); });
+	ASSERT_EQ((std::vector<std::size_t>{0, 2}), found);
+
+	found.clear();
+	index.find(v, 3, [&found](std::size_t i, const order&) { found.push_back(i); });
+	ASSERT_TRUE(found.empty());
+}
+
+TEST(chunk_bloom_index, removals)
+{
+	using vector_type = stable_vector<order, 16, std::allocator<order>, truncating_observer>;
+	vector_type v;
+	chunk_bloom_index<vector_type, order_id> index;
+	v.get_observer().attach(index);
+
+	auto find = [&](uint64_t id)
+	{
+		std::vector<std::size_t> found;
+		index.find(v, id, [&found](std::size_t i, const order&) { found.push_back(i); });
+		return found;
+	};
+
+	for (uint64_t i = 0; i < 40; ++i)
+		v.push_back({i, 0});
+	index.update(v);
+
+	// the same number of different elements
+	v.clear();
+	for (uint64_t i = 0; i < 40; ++i)
+		v.push_back({1000 + i, 0});
+	index.update(v);
+	ASSERT_EQ(std::vector<std::size_t>{5}, find(1005));
+	ASSERT_TRUE(find(5).empty());
+
+	v.begin_batch();
+	for (uint64_t i = 0; i < 10; ++i)
+		v.push_back({2000 + i, 0});
+	v.commit();
+	index.update(v);
+
+	// elements of a batch are not indexed before it is committed
+	v.begin_batch();
+	v.push_back({3000, 0});
+	index.update(v);
+	v.rollback();
+	ASSERT_EQ(50, index.indexed_size());
+	v.push_back({4000, 0});
+	index.update(v);
+	ASSERT_EQ(std::vector<std::size_t>{50}, find(4000));
+	ASSERT_EQ(std::vector<std::size_t>{49}, find(2009));
+
+	// without the observer, update() detects a smaller container
+	chunk_bloom_index<vector_type, order_id> detached;
+	detached.update(v);
+	v.clear();
+	v.push_back({7, 0});
+	detached.update(v);
+	std::vector<std::size_t> found;
+	detached.find(v, 7, [&found](std::size_t i, const order&) { found.push_back(i); });
+	ASSERT_EQ(std::vector<std::size_t>{0}, found);
+}
+
+TEST(chunk_bitmap, containers)
+{
+	chunk_bitmap<1024> sparse;
+	sparse.add(3);
+	sparse.add(700);
+	ASSERT_FALSE(sparse.is_bitset());
+
+	chunk_bitmap<1024> dense;
+	for (std::size_t i = 0; i < 1024; i += 2)
+		dense.add(i);
+	ASSERT_TRUE(dense.is_bitset());
+	ASSERT_EQ(512, dense.cardinality());
+
+	auto both = sparse & dense;
+	ASSERT_EQ(1, both.cardinality());
+	ASSERT_TRUE(both.contains(700));
+	ASSERT_FALSE(both.is_bitset());
+
+	auto either = sparse | dense;
+	ASSERT_EQ(513, either.cardinality());
+	ASSERT_TRUE(either.contains(3));
+
+	auto odd = chunk_bitmap<1024>();
+	for (std::size_t i = 1; i < 1024; i += 2)
+		odd.add(i);
+	auto none = odd & dense;
+	ASSERT_TRUE(none.empty());
+	ASSERT_FALSE(none.is_bitset());
+}
+
+struct fill
+{
+	int side;
+	int venue;
+};
+
+struct fill_side { int operator()(const fill& f) const { return f.side; } };
+struct fill_venue { int operator()(const fill& f) const { return f.venue; } };
+
+TEST(bitmap_index, predicates)
+{
+	using vector_type = stable_vector<fill, 64>;
+	vector_type v;
+	bitmap_index<vector_type, fill_side> side;
+	bitmap_index<vector_type, fill_venue> venue;
+
+	for (int i = 0; i < 1000; ++i)
+		v.push_back({i % 2, i % 5});
+	side.update(v);
+	venue.update(v);
+
+	ASSERT_EQ(2, side.distinct_keys());
+	ASSERT_EQ(5, venue.distinct_keys());
+	ASSERT_EQ(500, side.equal(1).count());
+
+	auto selected = (side.equal(1) & venue.any_of({0, 3})).to_selection_vector();
+	std::vector<std::size_t> expected;
+	for (std::size_t i = 0; i < v.size(); ++i)
+		if (v[i].side == 1 && (v[i].venue == 0 || v[i].venue == 3))
+			expected.push_back(i);
+	ASSERT_EQ(expected, selected);
+
+	ASSERT_EQ(0, side.equal(2).count());
+	ASSERT_EQ(0, (side.equal(2) & venue.equal(0)).count());
+	ASSERT_EQ(200, (side.equal(2) | venue.equal(0)).count());
+}
+
+TEST(bitmap_index, removals)
+{
+	using vector_type = stable_vector<fill, 64, std::allocator<fill>, truncating_observer>;
+	vector_type v;
+	bitmap_index<vector_type, fill_venue> venue;
+	v.get_observer().attach(venue);
+
+	for (int i = 0; i < 100; ++i)
+		v.push_back({0, i % 5});
+	venue.update(v);
+
+	// the same number of elements, with other keys
+	v.assign(100, fill{0, 7});
+	venue.update(v);
+	ASSERT_EQ(1, venue.distinct_keys());
+	ASSERT_EQ(100, venue.equal(7).count());
+	ASSERT_EQ(0, venue.equal(3).count());
+
+	// the observer truncates the index as soon as elements are removed
+	v.clear();
+	ASSERT_EQ(0, venue.distinct_keys());
+	v.assign(100, fill{0, 7});
+	venue.update(v);
+
+	// without the observer, update() detects a smaller container
+	bitmap_index<vector_type, fill_venue> detached;
+	detached.update(v);
+	v.clear();
+	v.push_back({0, 1});
+	detached.update(v);
+	ASSERT_EQ(std::vector<std::size_t>{0}, detached.equal(1).to_selection_vector());
+	ASSERT_EQ(0, detached.equal(7).count());
+}
+
+struct order_price
+{
+	int operator()(const order& o) const { return o.price; }
+};
+
+TEST(ordered_index, range)
+{
+	using vector_type = stable_vector<order, 128>;
+	vector_type v;
+	ordered_index<vector_type, order_price> index;
+	std::multimap<int, std::size_t> expected;
+
+	std::mt19937 rng(1);
+	for (uint64_t i = 0; i < 20000; ++i)
+	{
+		const int price = static_cast<int>(rng() % 5000);
+		v.push_back({i, price});
+		expected.emplace(price, i);
+
+		// the index is updated in batches of various sizes
+		if (rng() % 64 == 0)
+			index.update(v);
+	}
+	index.update(v);
+
+	ASSERT_EQ(v.size(), index.size());
+	ASSERT_GT(index.height(), 1);
+
+	auto it = index.begin(v);
+	for (const auto& e : expected)
+	{
+		ASSERT_EQ(e.second, it.index());
+		ASSERT_EQ(e.first, it->price);
+		++it;
+	}
+	ASSERT_TRUE(it == index.end(v));
+
+	std::size_t count = 0;
+	for (const order& o : index.between(v, 1000, 1010))
+	{
+		ASSERT_GE(o.price, 1000);
+		ASSERT_LT(o.price, 1010);
+		++count;
+	}
+	ASSERT_EQ(std::distance(expected.lower_bound(1000), expected.lower_bound(1010)), count);
+
+	auto range = index.equal_range(v, 4321);
+	auto expected_range = expected.equal_range(4321);
+	for (auto e = expected_range.first; e != expected_range.second; ++e, ++range.first)
+		ASSERT_EQ(e->second, range.first.index());
+	ASSERT_TRUE(range.first == range.last);
+
+	ASSERT_TRUE(index.lower_bound(v, 5000) == index.end(v));
+}
+
+TEST(ordered_index, removals)
+{
+	using vector_type = stable_vector<order, 16, std::allocator<order>, truncating_observer>;
+	vector_type v;
+	ordered_index<vector_type, order_price> index;
+	v.get_observer().attach(index);
+
+	for (int i = 0; i < 100; ++i)
+		v.push_back({0, i});
+	index.update(v);
+
+	v.assign(100, order{0, 1000});
+	index.update(v);
+	ASSERT_EQ(100, index.size());
+	ASSERT_EQ(index.end(v), index.lower_bound(v, 1001));
+	ASSERT_EQ(0, index.lower_bound(v, 0).index());
+
+	// without the observer, update() detects a smaller container
+	ordered_index<vector_type, order_price> detached;
+	detached.update(v);
+	v.clear();
+	v.push_back({0, 5});
+	detached.update(v);
+	ASSERT_EQ(1, detached.size());
+	ASSERT_EQ(5, detached.begin(v)->price);
+}
+
+TEST(ordered_index, truncate)
+{
+	using vector_type = stable_vector<order, 128>;
+	vector_type v;
+	ordered_index<vector_type, order_price> index;
+
+	for (int i = 0; i < 20000; ++i)
+		v.push_back({0, i * 7919 % 1009});
+	index.update(v);
+	const std::size_t height = index.height();
+	ASSERT_EQ(2, height);
+
+	auto check = [&](std::size_t size)
+	{
+		std::vector<std::pair<int, std::size_t>> expected;
+		for (std::size_t i = 0; i < size; ++i)
+			expected.emplace_back(v[i].price, i);
+		std::sort(expected.begin(), expected.end());
+
+		std::vector<std::pair<int, std::size_t>> entries;
+		for (auto it = index.begin(v); it != index.end(v); ++it)
+			entries.emplace_back(it->price, it.index());
+		ASSERT_EQ(expected, entries);
+
+		for (int key : {0, 1, 500, 1008})
+		{
+			auto range = index.equal_range(v, key);
+			const auto bounds = std::equal_range(expected.begin(), expected.end(), std::make_pair(key, std::size_t(0)),
+				[](const std::pair<int, std::size_t>& a, const std::pair<int, std::size_t>& b) { return a.first < b.first; });
+			ASSERT_EQ(bounds.second - bounds.first, std::distance(range.first, range.last));
+		}
+	};
+
+	// the entries of the remaining elements are kept, and the tree only shrinks
+	index.truncate(12345);
+	ASSERT_EQ(12345, index.size());
+	ASSERT_LE(index.height(), height);
+	check(12345);
+
+	index.truncate(7);
+	ASSERT_EQ(0, index.height());
+	check(7);
+
+	index.update(v);
+	ASSERT_EQ(20000, index.size());
+	check(20000);
+}
+
+TEST(ordered_index, increasing_keys)
+{
+	using vector_type = stable_vector<order, 128>;
+	vector_type v;
+	ordered_index<vector_type, order_price> index;
+
+	for (int i = 0; i < 10000; ++i)
+		v.push_back({0, i / 3});
+	index.update(v);
+
+	ASSERT_EQ(3, std::distance(index.equal_range(v, 100).begin(), index.equal_range(v, 100).end()));
+	ASSERT_EQ(300, index.lower_bound(v, 100).index());
+	ASSERT_EQ(9999, index.lower_bound(v, 3333).index());
+}
+
+TEST(stable_vector_parallel, argsort)
+{
+	stable_vector<int, 64> v;
+	std::mt19937 rng(2);
+	for (int i = 0; i < 5000; ++i)
+		v.push_back(static_cast<int>(rng() % 100));
+
+	std::vector<uint32_t> expected(v.size());
+	std::iota(expected.begin(), expected.end(), 0);
+	std::stable_sort(expected.begin(), expected.end(), [&v](uint32_t a, uint32_t b) { return v[a] < v[b]; });
+
+	for (unsigned threads : {1, 3, 4, 16})
+	{
+		auto permutation = argsort(v, std::less<int>(), threads);
+		ASSERT_TRUE(std::equal(expected.begin(), expected.end(), permutation.begin(), permutation.end()));
+	}
+}
+
+TEST(stable_vector_parallel, sorted_view)
+{
+	stable_vector<int, 4> v = {5, 3, 9, 1, 7, 2};
+	const int* first = &v[0];
+
+	auto permutation = argsort(v, std::greater<int>());
+	auto view = make_sorted_view(v, permutation);
+
+	std::vector<int> sorted(view.begin(), view.end());
+	ASSERT_EQ((std::vector<int>{9, 7, 5, 3, 2, 1}), sorted);
+	ASSERT_EQ(1, view[5]);
+	ASSERT_EQ(first, &v[0]);
+	ASSERT_EQ(5, v[0]);
+
+	// the view owns a temporary permutation
+	auto ascending = make_sorted_view(v, argsort(v, std::less<int>(), 2));
+	ASSERT_EQ((std::vector<int>{1, 2, 3, 5, 7, 9}), std::vector<int>(ascending.begin(), ascending.end()));
+}
+
+TEST(stable_vector_parallel, inclusive_scan)
+{
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> dist(0, 100);
+
+	stable_vector<int, 16> v;
+	for (int i = 0; i < 1000; ++i)
+		v.push_back(dist(gen));
+
+	std::vector<long long> expected(v.begin(), v.end());
+	std::partial_sum(expected.begin(), expected.end(), expected.begin());
+
+	stable_vector<long long, 16> out;
+	inclusive_scan(v, out, std::plus<>(), 3);
+	ASSERT_TRUE(std::equal(expected.begin(), expected.end(), out.begin(), out.end()));
+
+	inclusive_scan(v, v, std::plus<>(), 4);
+	ASSERT_TRUE(std::equal(expected.begin(), expected.end(), v.begin(), v.end()));
+
+	// elements of out past the size of in are left untouched
+	stable_vector<int, 4> ones(6, 1);
+	stable_vector<int, 4> longer(8, 100);
+	inclusive_scan(ones, longer, std::plus<>(), 2);
+	ASSERT_EQ((std::vector<int>{1, 2, 3, 4, 5, 6, 100, 100}), std::vector<int>(longer.begin(), longer.end()));
+}
+
+TEST(stable_vector_parallel, exclusive_scan)
+{
+	stable_vector<int, 16> v(100, 1);
+	stable_vector<int, 16> out;
+	exclusive_scan(v, out, 10, std::plus<>(), 3);
+
+	ASSERT_EQ(100, out.size());
+	for (int i = 0; i < 100; ++i)
+		ASSERT_EQ(10 + i, out[static_cast<std::size_t>(i)]);
+
+	exclusive_scan(v, v, 0, std::plus<>(), 5);
+	for (int i = 0; i < 100; ++i)
+		ASSERT_EQ(i, v[static_cast<std::size_t>(i)]);
+}
+
+TEST(stable_vector_parallel, scan_not_commutative)
+{
+	stable_vector<std::string, 4> v;
+	for (char c = 'a'; c <= 'z'; ++c)
+		v.push_back(std::string(1, c));
+
+	inclusive_scan(v, v, std::plus<>(), 3);
+	ASSERT_EQ("abcd", v[3]);
+	ASSERT_EQ("abcdefghijklmnopqrstuvwxyz", v[25]);
+}
+
+TEST(stable_vector_parallel, generate)
+{
+	auto v = generate<stable_vector<int, 16>>(1000, [](std::size_t i) { return static_cast<int>(i * 2); }, 3);
+
+	ASSERT_EQ(1000, v.size());
+	ASSERT_EQ(63, v.chunk_count());
+	for (std::size_t i = 0; i < v.size(); ++i)
+		ASSERT_EQ(static_cast<int>(i * 2), v[i]);
+
+	v.push_back(-1);
+	ASSERT_EQ(-1, v.back());
+}
+
+TEST(stable_vector_parallel, generate_throws)
+{
+	auto p = std::make_shared<int>(0);
+	auto f = [&p](std::size_t i)
+	{
+		if (i == 500)
+			throw std::runtime_error("generate");
+		return p;
+	};
+
+	ASSERT_THROW((generate<stable_vector<std::shared_ptr<int>, 16>>(1000, f, 4)), std::runtime_error);
+	ASSERT_EQ(1, p.use_count());
+}
+
+TEST(stable_vector_parallel, deterministic_sum)
+{
+	std::mt19937_64 gen(5);
+	std::uniform_real_distribution<double> dist(-1e6, 1e6);
+
+	stable_vector<double, 64> v;
+	for (int i = 0; i < 10000; ++i)
+		v.push_back(dist(gen) * (i % 7 == 0 ? 1e10 : 1.0));
+
+	for (auto method : {summation::naive, summation::kahan, summation::pairwise})
+	{
+		const double reference = deterministic_sum(v, method, 1);
+		for (unsigned threads = 2; threads <= 8; ++threads)
+		{
+			const double sum = deterministic_sum(v, method, threads);
+			ASSERT_EQ(0, std::memcmp(&reference, &sum, sizeof(double)));
+		}
+	}
+
+	ASSERT_EQ(0.0, deterministic_sum(stable_vector<double, 64>()));
+}
+
+TEST(stable_vector_parallel, compensated_sum)
+{
+	stable_vector<double, 1024> v(1000000, 0.1);
+
+	const double naive = deterministic_sum(v, summation::naive, 3);
+	const double kahan = deterministic_sum(v, summation::kahan, 3);
+	const double pairwise = deterministic_sum(v, summation::pairwise, 3);
+
+	ASSERT_LE(std::abs(kahan - 100000.0), std::abs(naive - 100000.0));
+	ASSERT_LE(std::abs(pairwise - 100000.0), std::abs(naive - 100000.0));
+	ASSERT_NEAR(100000.0, kahan, 1e-9);
+}
+
+TEST(stable_vector_parallel, deterministic_reduce)
+{
+	stable_vector<int, 16> v;
+	for (int i = 0; i < 1000; ++i)
+		v.push_back((i * 37) % 1001);
+
+	auto max = [](int a, int b) { return std::max(a, b); };
+	ASSERT_EQ(1000, deterministic_reduce(v, 0, max, 4));
+	ASSERT_EQ(std::accumulate(v.begin(), v.end(), 0LL), deterministic_reduce(v, 0LL, std::plus<long long>(), 3));
+}
+
+TEST(work_cursor, claim)
+{
+	stable_vector<int, 4> v = {0, 1, 2, 3, 4, 5};
+	work_cursor<stable_vector<int, 4>> cursor(1, 2);
+
+	ASSERT_TRUE(cursor.try_claim().empty());
+	cursor.publish(v);
+
+	// batches stop at chunk boundaries
+	auto b = cursor.claim();
+	ASSERT_EQ(0, b.first);
+	ASSERT_EQ(3, b.count);
+	ASSERT_EQ(&v[0], b.data);
+
+	b = cursor.claim();
+	ASSERT_EQ(3, b.first);
+	ASSERT_EQ(1, b.count);
+
+	b = cursor.claim();
+	ASSERT_EQ(4, b.first);
+	ASSERT_EQ(2, b.count);
+	ASSERT_EQ(&v[4], b.data);
+
+	cursor.close();
+	ASSERT_TRUE(cursor.claim().empty());
+}
+
+TEST(work_cursor, workers)
+{
+	using vector_type = stable_vector<int, 256>;
+	const int count = 100000;
+	const unsigned workers = 4;
+
+	vector_type v;
+	work_cursor<vector_type> cursor(workers);
+	std::vector<int> seen(count, 0);
+
+	std::vector<std::thread> threads;
+	for (unsigned w = 0; w < workers; ++w)
+	{
+		threads.emplace_back([&cursor, &seen]()
+		{
+			for (auto b = cursor.claim(); !b.empty(); b = cursor.claim())
+			{
+				ASSERT_LE(b.first % 256 + b.count, 256);
+				for (const int& i : b)
+					++seen[static_cast<std::size_t>(i)];
+			}
+		});
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		v.push_back(i);
+		if (i % 1000 == 0)
+			cursor.publish(v);
+	}
+	cursor.publish(v);
+	cursor.close();
+
+	for (auto& t : threads)
+		t.join();
+
+	ASSERT_EQ(static_cast<std::size_t>(count), cursor.claimed());
+	ASSERT_TRUE(std::all_of(seen.begin(), seen.end(), [](int n) { return n == 1; }));
+}
+
+TEST(stable_spsc_queue, push_pop)
+{
+	stable_spsc_queue<int, 4> q;
+	ASSERT_EQ(nullptr, q.front());
+
+	q.push(1);
+	q.push(2);
+	ASSERT_EQ(nullptr, q.front());
+
+	q.publish();
+	ASSERT_EQ(2, q.read_available());
+
+	int* first = q.front();
+	ASSERT_EQ(1, *first);
+	q.pop();
+	ASSERT_EQ(2, *q.front());
+	q.pop();
+	ASSERT_EQ(nullptr, q.front());
+
+	// popped elements stay in place until released
+	ASSERT_EQ(1, *first);
+	q.release();
+}
+
+TEST(stable_spsc_queue, recycle_chunks)
+{
+	stable_spsc_queue<int, 4> q;
+	for (int i = 0; i < 5; ++i)
+		q.push(i);
+	q.publish();
+
+	const int* first = q.front();
+	for (int i = 0; i < 5; ++i)
+	{
+		ASSERT_EQ(i, *q.front());
+		q.pop();
+	}
+	q.release();
+
+	// the first chunk is consumed, the producer reuses it once the second one is full
+	for (int i = 5; i < 9; ++i)
+		q.push(i);
+	q.publish();
+
+	for (int i = 5; i < 9; ++i)
+	{
+		ASSERT_EQ(i, *q.front());
+		ASSERT_EQ(i == 8, first == q.front());
+		q.pop();
+	}
+}
+
+TEST(stable_spsc_queue, destroys_elements)
+{
+	auto p = std::make_shared<int>(0);
+	{
+		stable_spsc_queue<std::shared_ptr<int>, 4> q;
+		for (int i = 0; i < 10; ++i)
+			q.push(p);
+		q.publish();
+		q.push(p);
+
+		for (int i = 0; i < 6; ++i)
+		{
+			q.front();
+			q.pop();
+		}
+		ASSERT_EQ(12, p.use_count());
+
+		q.release();
+		ASSERT_EQ(6, p.use_count());
+	}
+	ASSERT_EQ(1, p.use_count());
+}
+
+TEST(stable_spsc_queue, throwing_constructor)
+{
+	struct thrower
+	{
+		operator int() const { throw std::runtime_error("thrower"); }
+	};
+
+	// the element that throws opens a chunk
+	stable_spsc_queue<int, 2> q;
+	q.push(0);
+	q.push(1);
+	ASSERT_THROW(q.emplace(thrower()), std::runtime_error);
+	q.push(2);
+	ASSERT_THROW(q.emplace(thrower()), std::runtime_error);
+	q.push(3);
+	q.publish();
+
+	for (int i = 0; i < 4; ++i)
+	{
+		ASSERT_EQ(i, *q.front());
+		q.pop();
+	}
+	ASSERT_EQ(nullptr, q.front());
+}
+
+TEST(stable_spsc_queue, threads)
+{
+	const int count = 100000;
+	stable_spsc_queue<int, 64> q;
+
+	std::thread producer([&q]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			q.push(i);
+			if (i % 16 == 0)
+				q.publish();
+		}
+		q.publish();
+	});
+
+	for (int i = 0; i < count; ++i)
+	{
+		const int* t;
+		while (!(t = q.front()))
+			std::this_thread::yield();
+
+		ASSERT_EQ(i, *t);
+		q.pop();
+		if (i % 100 == 0)
+			q.release();
+	}
+	producer.join();
+}
+
+TEST(crc32c, known_values)
+{
+	const char data[] = "123456789";
+	ASSERT_EQ(0xE3069283u, crc32c(data, 9));
+	ASSERT_EQ(0xE3069283u, crc32c(data + 4, 5, crc32c(data, 4)));
+	ASSERT_EQ(0u, crc32c(data, 0));
+}
+
+TEST(crc32c, hardware_matches_software)
+{
+	std::mt19937 gen(7);
+	std::vector<unsigned char> data(1027);
+	for (auto& c : data)
+		c = static_cast<unsigned char>(gen());
+
+	for (std::size_t size : {0, 1, 7, 8, 9, 1000, 1027})
+		ASSERT_EQ(crc32c_detail::software(~0u, data.data(), size), crc32c_detail::hardware(~0u, data.data(), size));
+}
+
+TEST(chunk_checksums, verify)
+{
+	using vector_type = stable_vector<int, 16>;
+	vector_type v;
+	chunk_checksums<vector_type> checksums;
+
+	for (int i = 0; i < 70; ++i)
+		v.push_back(i);
+	checksums.update(v);
+
+	// the last chunk is not sealed yet
+	ASSERT_EQ(4, checksums.sealed_chunks());
+	ASSERT_TRUE(checksums.verify(v, 3).empty());
+	ASSERT_FALSE(checksums.verify_chunk(v, 4));
+
+	v[20] = -1;
+	v[63] = -1;
+	ASSERT_FALSE(checksums.verify_chunk(v, 1));
+	ASSERT_EQ(std::vector<std::size_t>({1, 3}), checksums.verify(v, 3));
+
+	chunk_checksums<vector_type> loaded(checksums.checksums());
+	ASSERT_TRUE(loaded.verify_chunk(v, 0));
+	ASSERT_FALSE(loaded.verify_chunk(v, 1));
+}
+
+constexpr static_stable_vector<int, 100, 16> make_squares()
+{
+	static_stable_vector<int, 100, 16> v;
+	for (int i = 0; i < 40; ++i)
+		v.push_back(i * i);
+	return v;
+}
+
+TEST(static_stable_vector, constexpr_table)
+{
+	static constexpr auto squares = make_squares();
+	static_assert(squares.size() == 40, "");
+	static_assert(squares[12] == 144, "");
+	static_assert(squares.back() == 39 * 39, "");
+	static_assert(squares.chunk_count() == 3 && squares.chunk_length(2) == 8, "");
+
+	static constexpr static_stable_vector<int, 4> primes = {2, 3, 5, 7};
+	static_assert(primes.size() == 4 && primes.at(3) == 7, "");
+
+	ASSERT_EQ(256, squares.chunk_data(1)[0]);
+	ASSERT_EQ(17, std::accumulate(primes.begin(), primes.end(), 0));
+	ASSERT_THROW(primes.at(4), std::out_of_range);
+}
+
+TEST(static_stable_vector, capacity)
+{
+	static_stable_vector<int, 2> v;
+	v.push_back(1);
+	v.emplace_back(2);
+	ASSERT_THROW(v.push_back(3), std::length_error);
+	ASSERT_EQ(2, v.size());
+}
+
+TEST(stable_multi_vector, push_back)
+{
+	stable_multi_vector<int, 64, 2> mv;
+	const auto a = mv.create();
+	const auto b = mv.create();
+	ASSERT_EQ(2, mv.vector_count());
+	ASSERT_TRUE(mv[a].empty());
+
+	std::vector<const int*> addresses;
+	for (int i = 0; i < 1000; ++i)
+	{
+		mv[a].push_back(i);
+		mv.push_back(b, -i);
+		addresses.push_back(&mv[a].back());
+	}
+
+	ASSERT_EQ(1000, mv[a].size());
+	ASSERT_EQ(1000, mv.size(b));
+	for (std::size_t i = 0; i < 1000; ++i)
+	{
+		ASSERT_EQ(static_cast<int>(i), mv[a][i]);
+		ASSERT_EQ(-static_cast<int>(i), mv.get(b, i));
+		ASSERT_EQ(addresses[i], &mv[a][i]);
+	}
+
+	const auto& c = mv;
+	ASSERT_EQ(999 * 1000 / 2, std::accumulate(c[a].begin(), c[a].end(), 0));
+	ASSERT_THROW(c[a].at(1000), std::out_of_range);
+}
+
+TEST(stable_multi_vector, destroys_elements)
+{
+	auto p = std::make_shared<int>(0);
+	{
+		stable_multi_vector<std::shared_ptr<int>, 16> mv;
+		for (int v = 0; v < 10; ++v)
+		{
+			const auto id = mv.create();
+			for (int i = 0; i < v * 7; ++i)
+				mv[id].emplace_back(p);
+		}
+		ASSERT_EQ(1 + 7 * 45, p.use_count());
+	}
+	ASSERT_EQ(1, p.use_count());
+}
+
+TEST(stable_multi_vector, move)
+{
+	auto p = std::make_shared<int>(0);
+	auto q = std::make_shared<int>(1);
+	{
+		stable_multi_vector<std::shared_ptr<int>, 16> a;
+		a[a.create()].push_back(p);
+
+		stable_multi_vector<std::shared_ptr<int>, 16> b;
+		const auto id = b.create();
+		for (int i = 0; i < 20; ++i)
+			b[id].push_back(q);
+
+		// the elements of the target are destroyed
+		a = std::move(b);
+		ASSERT_EQ(1, p.use_count());
+		ASSERT_EQ(21, q.use_count());
+		ASSERT_EQ(1, a.vector_count());
+		ASSERT_EQ(20, a.size(0));
+
+		stable_multi_vector<std::shared_ptr<int>, 16> c(std::move(a));
+		ASSERT_EQ(0, a.vector_count());
+		ASSERT_EQ(q, c[0][19]);
+	}
+	ASSERT_EQ(1, q.use_count());
+}
+
+TEST(stable_multi_vector, memory)
+{
+	const std::size_t count = 10000;
+	stable_multi_vector<uint64_t> mv;
+	for (std::size_t v = 0; v < count; ++v)
+	{
+		const auto id = mv.create();
+		for (uint64_t i = 0; i < 3; ++i)
+			mv[id].push_back(i);
+	}
+
+	// a stable_vector per key would take a chunk of 1024 elements each
+	ASSERT_LT(mv.memory_used(), count * 1024 * sizeof(uint64_t) / 100);
+}
+
+TEST(stable_vector_file, ranges)
+{
+	const std::string path = ::testing::TempDir() + "stable_vector_file_ranges";
+	using file_type = stable_vector_file<int64_t, 16>;
+
+	stable_vector<int64_t, 16> v;
+	for (int64_t i = 0; i < 1000; ++i)
+		v.push_back(i * 3);
+	file_type::save(v, path);
+
+	file_type file(path);
+	ASSERT_EQ(1000, file.size());
+	ASSERT_EQ(63, file.chunk_count());
+
+	auto loaded = file.read_range(100, 200);
+	ASSERT_EQ(96, loaded.base());
+	ASSERT_EQ(7, loaded.chunks().chunk_count());
+	for (std::size_t i = 100; i < 200; ++i)
+		ASSERT_EQ(v[i], loaded[i]);
+
+	auto tail = file.read_range(990, 1000);
+	ASSERT_EQ(v[999], tail[999]);
+
+	auto mapped = file.map_range(500, 1000, true);
+	for (std::size_t i = 500; i < 1000; ++i)
+		ASSERT_EQ(v[i], mapped[i]);
+
+	ASSERT_THROW(file.read_range(0, 1001), std::out_of_range);
+	ASSERT_THROW((stable_vector_file<int64_t, 32>(path)), std::runtime_error);
+	std::remove(path.c_str());
+}
+
+TEST(stable_vector_file, corruption)
+{
+	const std::string path = ::testing::TempDir() + "stable_vector_file_corruption";
+	using file_type = stable_vector_file<int, 16>;
+
+	file_type::save(stable_vector<int, 16>(100, 7), path);
+	{
+		std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+		f.seekp(200);
+		f.put('x');
+	}
+
+	file_type file(path);
+	ASSERT_NO_THROW(file.read_range(0, 16));
+	ASSERT_THROW(file.read_range(0, 100), std::runtime_error);
+	ASSERT_NO_THROW(file.read_range(0, 100, false));
+	ASSERT_THROW(file.map_range(32, 48, true), std::runtime_error);
+	std::remove(path.c_str());
+}
+
+TEST(stable_vector_file, corrupt_footer)
+{
+	const std::string path = ::testing::TempDir() + "stable_vector_file_corrupt_footer";
+	using file_type = stable_vector_file<int, 16>;
+
+	// overwrites the 64-bit integer at offset from the end of the file
+	auto corrupt = [&path](std::streamoff offset, uint64_t value)
+	{
+		file_type::save(stable_vector<int, 16>(100, 7), path);
+		std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+		f.seekp(offset, std::ios::end);
+		f.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+
+	// trailer: chunk count, size, index offset, magic; the last index entry: offset, count, crc
+	corrupt(-32, 0);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+	corrupt(-32, 1000);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+	corrupt(-24, 1000);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+	corrupt(-16, 1u << 30);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+	corrupt(-56, 1u << 30);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+	corrupt(-48, 16);
+	ASSERT_THROW(file_type file(path), std::runtime_error);
+
+	corrupt(-40, 0);
+	ASSERT_NO_THROW(file_type file(path));
+	std::remove(path.c_str());
+}
+
+struct resting_order
+{
+	uint64_t id;
+	int price;
+	index_link level;
+};
+
+TEST(index_list, member_links)
+{
+	using book_type = stable_vector<resting_order, 4>;
+	book_type orders;
+	member_links<book_type, &resting_order::level> links(orders);
+	std::map<int, index_list> levels;
+
+	for (uint32_t i = 0; i < 10; ++i)
+	{
+		orders.push_back({i, 100 + static_cast<int>(i % 2), index_link()});
+		levels[orders.back().price].push_back(links, i);
+	}
+
+	index_list& level = levels[100];
+	ASSERT_EQ(5, level.size());
+	ASSERT_EQ(0, level.front());
+	ASSERT_EQ(8, level.back());
+
+	level.erase(links, 4);
+	level.push_front(links, 4);
+	level.erase(links, 8);
+	level.insert_before(links, 2, 8);
+
+	std::vector<uint32_t> fifo;
+	level.for_each(links, [&fifo](uint32_t i) { fifo.push_back(i); });
+	ASSERT_EQ(std::vector<uint32_t>({4, 0, 8, 2, 6}), fifo);
+	ASSERT_EQ(0, index_list::prev(links, 8));
+	ASSERT_EQ(2, index_list::next(links, 8));
+
+	while (!level.empty())
+		level.pop_front(links);
+	ASSERT_EQ(index_list::npos, level.front());
+	ASSERT_EQ(index_link::npos, level.back());
+	ASSERT_EQ(5, levels[101].size());
+}
+
+TEST(index_list, side_links)
+{
+	side_links<16> links;
+	index_list odd, even;
+	for (uint32_t i = 0; i < 100; ++i)
+		(i % 2 ? odd : even).push_back(links, i);
+
+	// erasing while iterating
+	even.for_each(links, [&](uint32_t i) { if (i % 4 == 0) even.erase(links, i); });
+	ASSERT_EQ(25, even.size());
+	ASSERT_EQ(2, even.front());
+	ASSERT_EQ(50, odd.size());
+	ASSERT_EQ(99, odd.back());
+}
+
+TEST(indexed_heap, order)
+{
+	using vector_type = stable_vector<int, 8>;
+	std::mt19937 gen(3);
+	std::uniform_int_distribution<int> dist(0, 1000);
+
+	vector_type deadlines;
+	indexed_heap<vector_type> heap;
+	for (uint32_t i = 0; i < 200; ++i)
+	{
+		deadlines.push_back(dist(gen));
+		heap.push(deadlines, i);
+	}
+
+	// decrease and increase keys, and erase some elements
+	for (uint32_t i = 0; i < 200; i += 3)
+	{
+		deadlines[i] = dist(gen);
+		heap.update(deadlines, i);
+	}
+	for (uint32_t i = 1; i < 200; i += 5)
+		heap.erase(deadlines, i);
+	ASSERT_FALSE(heap.contains(1));
+	ASSERT_TRUE(heap.contains(2));
+
+	std::vector<int> expected;
+	for (uint32_t i = 0; i < 200; ++i)
+		if (i % 5 != 1)
+			expected.push_back(deadlines[i]);
+	std::sort(expected.begin(), expected.end());
+
+	std::vector<int> popped;
+	while (!heap.empty())
+		popped.push_back(deadlines[heap.pop(deadlines)]);
+	ASSERT_EQ(expected, popped);
+}
+
+TEST(indexed_heap, compare)
+{
+	using vector_type = stable_vector<order, 8>;
+	auto by_price = [](const order& a, const order& b) { return a.price > b.price; };
+
+	vector_type orders = {{1, 10}, {2, 30}, {3, 20}};
+	indexed_heap<vector_type, decltype(by_price), 2> heap(by_price);
+	for (uint32_t i = 0; i < orders.size(); ++i)
+		heap.push(orders, i);
+	ASSERT_EQ(1, heap.top());
+
+	orders[0].price = 40;
+	heap.update(orders, 0);
+	ASSERT_EQ(0, heap.top());
+	heap.erase(orders, 0);
+	ASSERT_EQ(1, heap.top());
+	ASSERT_EQ(2, heap.size());
+}
+
+TEST(stable_vector_diff, ranges)
+{
+	using vector_type = stable_vector<int, 8>;
+	vector_type a;
+	for (int i = 0; i < 100; ++i)
+		a.push_back(i);
+
+	vector_type b = a;
+	ASSERT_TRUE(diff(a, b, 3).empty());
+
+	b[5] = -1;
+	b[6] = -1;
+	for (std::size_t i = 30; i < 34; ++i)
+		b[i] = -1;
+	b[99] = -1;
+	b.push_back(100);
+	b.push_back(101);
+
+	const std::vector<index_range> expected = {{5, 7}, {30, 34}, {99, 102}};
+	ASSERT_EQ(expected, diff(a, b, 3));
+	ASSERT_EQ(expected, diff(a, b, 1));
+}
+
+TEST(stable_vector_diff, operator_equal)
+{
+	stable_vector<std::string, 4> a = {"a", "b", "c", "d", "e"};
+	stable_vector<std::string, 4> b = {"a", "b", "x", "d", "y"};
+	ASSERT_EQ((std::vector<index_range>{{2, 3}, {4, 5}}), diff(a, b));
+
+	stable_vector<double, 4> zeros = {0.0, 0.0};
+	stable_vector<double, 4> negative_zeros = {-0.0, 0.0};
+	ASSERT_TRUE(diff(zeros, negative_zeros).empty());
+}
+
+TEST(stable_vector_diff, checksums)
+{
+	using vector_type = stable_vector<int, 8>;
+	vector_type a(40, 1);
+	vector_type b(40, 1);
+	b[12] = 2;
+	b[35] = 2;
+
+	chunk_checksums<vector_type> checksums_a, checksums_b;
+	checksums_a.update(a);
+	checksums_b.update(b);
+
+	ASSERT_EQ((std::vector<index_range>{{12, 13}, {35, 36}}), diff(a, checksums_a, b, checksums_b));
+
+	// equal checksums do not hide differences, nor do outdated ones
+	b[3] = 2;
+	b[12] = 1;
+	ASSERT_EQ((std::vector<index_range>{{3, 4}, {35, 36}}), diff(a, checksums_a, b, checksums_b));
+	ASSERT_EQ(diff(a, b), diff(a, checksums_a, b, checksums_b));
+}
+
+TEST(stable_vector_arrow, schema)
+{
+	ArrowSchema schema;
+	export_arrow_schema<stable_vector<int32_t>>(&schema);
+
+	ASSERT_STREQ("i", schema.format);
+	ASSERT_EQ(0, schema.n_children);
+
+	schema.release(&schema);
+	ASSERT_TRUE(schema.release == nullptr);
+}
+
+TEST(stable_vector_arrow, stream)
+{
+	auto v = std::make_shared<stable_vector<int64_t, 4>>();
+	for (int64_t i = 0; i < 10; ++i)
+		v->push_back(i);
+
+	ArrowArrayStream stream;
+	export_arrow_stream<stable_vector<int64_t, 4>>(v, &stream);
+
+	ArrowSchema schema;
+	ASSERT_EQ(0, stream.get_schema(&stream, &schema));
+	ASSERT_STREQ("l", schema.format);
+	schema.release(&schema);
+
+	std::vector<ArrowArray> arrays;
+	for (;;)
+	{
+		ArrowArray array;
+		ASSERT_EQ(0, stream.get_next(&stream, &array));
+		if (array.release == nullptr)
+			break;
+		arrays.push_back(array);
+	}
+	stream.release(&stream);
+
+	ASSERT_EQ(3, arrays.size());
+	ASSERT_EQ(4, arrays[0].length);
+	ASSERT_EQ(4, arrays[1].length);
+	ASSERT_EQ(2, arrays[2].length);
+
+	// zero-copy: the data buffers are the chunks themselves
+	ASSERT_EQ(&(*v)[0], arrays[0].buffers[1]);
+	ASSERT_EQ(&(*v)[4], arrays[1].buffers[1]);
+	ASSERT_EQ(&(*v)[8], arrays[2].buffers[1]);
+	ASSERT_TRUE(arrays[0].buffers[0] == nullptr);
+
+	// the arrays keep the container alive
+	const int64_t* last = static_cast<const int64_t*>(arrays[2].buffers[1]);
+	v.reset();
+	ASSERT_EQ(9, last[1]);
+
+	for (auto& array : arrays)
+	{
+		array.release(&array);
+		ASSERT_TRUE(array.release == nullptr);
+	}
+}
+
+TEST(stable_vector_arrow, chunk)
+{
+	auto v = std::make_shared<stable_vector<double, 4>>(std::initializer_list<double>{1.0, 2.0, 3.0, 4.0, 5.0});
+
+	ArrowArray array;
+	export_arrow_chunk(std::shared_ptr<const stable_vector<double, 4>>(v), 1, &array);
+
+	ASSERT_EQ(1, array.length);
+	ASSERT_EQ(5.0, static_cast<const double*>(array.buffers[1])[0]);
+	array.release(&array);
+}
+
+template <class ContainerT>
+int sum(const ContainerT& v)
+{
+	int sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const auto& i : v)
+	{
+		sum += i;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+	return sum;
+}
+
+static std::size_t ElementsCount = 10000000;
+
+TEST(stable_vector_iterator, performance)
+{
+	stable_vector<int, 4096> v(ElementsCount, 1);
+	int s = sum(v);
+	EXPECT_EQ(ElementsCount, s);
+}
+
+TEST(boost_stable_vector_iterator, performance)
+{
+	boost::container::stable_vector<int> v(ElementsCount, 1);
+	int s = sum(v);
+	EXPECT_EQ(ElementsCount, s);
+}
+
+TEST(list_iterator, performance)
+{
+	std::list<int> v(ElementsCount, 1);
+	int s = sum(v);
+	EXPECT_EQ(ElementsCount, s);
+}
+
+TEST(std_vector_iterator, performance)
+{
+	std::vector<int> v(10000000, 1);
+	int s = sum(v);
+	std::cout << s << std::endl;
+}
+
+// Classic bounded SPSC ring buffer, as a baseline for stable_spsc_queue.
+template <class T>
+class spsc_ring_buffer
+{
+public:
+	explicit spsc_ring_buffer(std::size_t capacity) : m_slots(capacity + 1) {}
+
+	bool push(const T& t)
+	{
+		const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		const std::size_t next = tail + 1 == m_slots.size() ? 0 : tail + 1;
+		if (next == m_head.load(std::memory_order_acquire))
+			return false;
+		m_slots[tail] = t;
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& t)
+	{
+		const std::size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		t = m_slots[head];
+		m_head.store(head + 1 == m_slots.size() ? 0 : head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> m_slots;
+	alignas(64) std::atomic<std::size_t> m_head{0};
+	alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+static const int QueueElementsCount = 1000000;
+
+TEST(stable_spsc_queue, performance)
+{
+	stable_spsc_queue<int, 4096> q;
+	long long s = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::thread producer([&q]()
+	{
+		for (int i = 0; i < QueueElementsCount; ++i)
+		{
+			q.push(1);
+			if (i % 64 == 63)
+				q.publish();
+		}
+		q.publish();
+	});
+
+	for (int i = 0; i < QueueElementsCount; ++i)
+	{
+		const int* t;
+		while (!(t = q.front()))
+			std::this_thread::yield();
+		s += *t;
+		q.pop();
+		if (i % 1024 == 1023)
+			q.release();
+	}
+	producer.join();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+	EXPECT_EQ(QueueElementsCount, s);
+}
+
+TEST(spsc_ring_buffer, performance)
+{
+	spsc_ring_buffer<int> q(4096);
+	long long s = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::thread producer([&q]()
+	{
+		for (int i = 0; i < QueueElementsCount; ++i)
+			while (!q.push(1))
+				std::this_thread::yield();
+	});
+
+	for (int i = 0; i < QueueElementsCount; ++i)
+	{
+		int t;
+		while (!q.pop(t))
+			std::this_thread::yield();
+		s += t;
+	}
+	producer.join();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+	EXPECT_EQ(QueueElementsCount, s);
+}
+
+struct timer
+{
+	uint64_t deadline;
+	uint64_t payload;
+};
+
+static const std::size_t TimersCount = 200000;
+
+static stable_vector<timer> make_timers()
+{
+	std::mt19937_64 gen(11);
+	stable_vector<timer> timers;
+	for (std::size_t i = 0; i < TimersCount; ++i)
+		timers.push_back({gen() % 1000000, i});
+	return timers;
+}
+
+TEST(indexed_heap, performance)
+{
+	auto timers = make_timers();
+	auto earlier = [](const timer& a, const timer& b) { return a.deadline < b.deadline; };
+	indexed_heap<stable_vector<timer>, decltype(earlier)> heap(earlier);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < TimersCount; ++i)
+		heap.push(timers, i);
+
+	uint64_t last = 0;
+	while (!heap.empty())
+	{
+		const uint64_t deadline = timers[heap.pop(timers)].deadline;
+		EXPECT_LE(last, deadline);
+		last = deadline;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+}
+
+TEST(priority_queue, performance)
+{
+	auto timers = make_timers();
+	auto later = [](const timer* a, const timer* b) { return a->deadline > b->deadline; };
+	std::priority_queue<const timer*, std::vector<const timer*>, decltype(later)> queue(later);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const auto& t : timers)
+		queue.push(&t);
+
+	uint64_t last = 0;
+	while (!queue.empty())
+	{
+		const uint64_t deadline = queue.top()->deadline;
+		queue.pop();
+		EXPECT_LE(last, deadline);
+		last = deadline;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+}
+
+TEST(indexed_heap, update_performance)
+{
+	auto timers = make_timers();
+	auto earlier = [](const timer& a, const timer& b) { return a.deadline < b.deadline; };
+	indexed_heap<stable_vector<timer>, decltype(earlier)> heap(earlier);
+	for (uint32_t i = 0; i < TimersCount; ++i)
+		heap.push(timers, i);
+
+	// rescheduling timers in place, which std::priority_queue cannot do
+	std::mt19937_64 gen(13);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (std::size_t n = 0; n < TimersCount; ++n)
+	{
+		const auto i = static_cast<uint32_t>(gen() % TimersCount);
+		timers[i].deadline = gen() % 1000000;
+		heap.update(timers, i);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "ms elapsed" << std::endl;
+	EXPECT_EQ(TimersCount, heap.size());
 }